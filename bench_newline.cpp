@@ -0,0 +1,154 @@
+// Curses GUI utilities: newline kernel micro-benchmark
+//
+// Times the newline kernels against a string::find loop and a getline
+// loop, the way lines were counted before them, on generated text of
+// random line lengths. The first argument is the size in megabytes (1024 if not
+// given), the second the scratch file for the file based runs. Set
+// UCURSES_KERNEL to avx2, sse2 or scalar to time a narrower kernel.
+
+#include "uview.h"
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+/***********************************************************************/
+/* Routine: seconds(start)                                             */
+/* Purpose: Seconds gone by since start.                               */
+/*                                                                     */
+/***********************************************************************/
+
+static double seconds(const struct timespec &start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec -
+					  start.tv_nsec) / 1e9;
+}
+
+/***********************************************************************/
+/* Routine: report(what, count, start, bytes)                          */
+/* Purpose: Print one timing as count, seconds and GB/s.               */
+/*                                                                     */
+/***********************************************************************/
+
+static void report(const char *what, long count,
+		   const struct timespec &start, size_t bytes)
+{
+    double s = seconds(start);
+
+    printf("%-22s %12ld %8.3fs %7.2f GB/s\n", what, count, s,
+	   s > 0 ? bytes / s / 1e9 : 0.0);
+}
+
+/***********************************************************************/
+/* Routine: findLoop(text)                                             */
+/* Purpose: Count lines with string::find, a newline at a time.        */
+/*                                                                     */
+/***********************************************************************/
+
+static long findLoop(const string & text)
+{
+    unsigned int cnt, x, index;
+
+    cnt = 0;
+    index = 0;
+    x = 0;
+    while (x < text.size()) {
+	x = text.find("\n", index);
+	index = x;
+	cnt++;
+	index++;
+    }
+    return cnt;
+}
+
+/***********************************************************************/
+/* Routine: getlineLoop(fname)                                         */
+/* Purpose: Count lines with getline, a line at a time.                */
+/*                                                                     */
+/***********************************************************************/
+
+static long getlineLoop(const char *fname)
+{
+    ifstream myfile;
+    string line;
+    long cnt = 0;
+
+    myfile.open(fname);
+    if (myfile.is_open()) {
+	while (!myfile.eof()) {
+	    getline(myfile, line);
+	    cnt++;
+	}
+    }
+    myfile.close();
+    return cnt;
+}
+
+int main(int argc, char **argv)
+{
+    struct timespec start;
+    vector < off_t > starts;
+    string text;
+    size_t bytes;
+    const char *fname;
+    off_t *end;
+    long n;
+
+    bytes = (size_t) (argc > 1 ? atol(argv[1]) : 1024) << 20;
+    fname = argc > 2 ? argv[2] : "/tmp/bench_newline.txt";
+
+    srand(1);
+    text.reserve(bytes + 128);
+    while (text.size() < bytes) {
+	text.append(rand() % 120, 'x');
+	text += '\n';
+    }
+    printf("%zu bytes, kernel %s\n", text.size(), newlineKernel());
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n = findLoop(text);
+    report("string::find loop", n, start, text.size());
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n = countNewlines(text.data(), text.size());
+    report("countNewlines", n, start, text.size());
+
+    starts.resize(n + 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    end = findNewlines(text.data(), text.size(), 0, &starts[0]);
+    report("findNewlines", end - &starts[0], start, text.size());
+
+    {
+	ofstream out(fname);
+	out << text;
+	if (!out) {
+	    cerr << "bench_newline: cannot write " << fname << endl;
+	    return 1;
+	}
+    }
+    text.clear();
+    text.shrink_to_fit();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n = getlineLoop(fname);
+    report("getline loop", n, start, bytes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    {
+	MappedFile doc;
+
+	doc.open(fname);
+	n = doc.lineCount();
+    }
+    report("MappedFile lineCount", n, start, bytes);
+
+    unlink(fname);
+    return 0;
+}
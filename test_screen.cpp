@@ -0,0 +1,149 @@
+// Curses GUI utilities: headless screen checks
+//
+// Drives the widgets on an in-memory screen and reads back what ended
+// up on it. Each check prints its name and ok or FAIL; the exit status
+// is the number that failed.
+
+#include "ucurses.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static int failed = 0;
+
+/***********************************************************************/
+/* Routine: check(what, ok)                                            */
+/* Purpose: Print one result and count it if it failed.                */
+/*                                                                     */
+/***********************************************************************/
+
+static void check(const char *what, bool ok)
+{
+    printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok)
+	failed++;
+}
+
+/***********************************************************************/
+/* Routine: tempFile(text)                                             */
+/* Purpose: Write text to a new scratch file and return its name.      */
+/*                                                                     */
+/***********************************************************************/
+
+static string tempFile(const char *text)
+{
+    char name[] = "/tmp/test_screenXXXXXX";
+    int fd;
+
+    fd = mkstemp(name);
+    if (fd == -1)
+	return "";
+    if (write(fd, text, strlen(text)) == -1)
+	name[0] = '\0';
+    close(fd);
+    return name;
+}
+
+/***********************************************************************/
+/* Routine: paintThenRefresh()                                         */
+/* Purpose: A row of stdscr changed by a widget that paints it, then   */
+/*          put back by printAt, must show what printAt wrote: damage  */
+/*          tracking compares with what the paint really sent.         */
+/***********************************************************************/
+
+static void paintThenRefresh(void)
+{
+    CursesGui gui(20, 60);
+    vector < string > files, rows;
+    string name;
+    bool ok = true;
+    int i;
+
+    name = tempFile("one\ntwo\n");
+    files.push_back(name);
+    gui.setDamageTracking(true);
+    gui.printBox();
+    for (i = 0; i < 3; i++) {
+	gui.printAt(1, 0, "|X");
+	gui.pushKey(KEY_F(3));
+	gui.fileViewTabs(files);
+	gui.printAt(1, 0, "|X");
+	rows = gui.getScreen();
+	ok = ok && rows[1][1] == 'X';
+    }
+    check("paint then refreshWin, tracked", ok);
+    unlink(name.c_str());
+}
+
+/***********************************************************************/
+/* Routine: copyClipped()                                              */
+/* Purpose: A copy whose source rectangle starts above and left of the */
+/*          source window lands its cells where they would have gone   */
+/*          unclipped.                                                 */
+/***********************************************************************/
+
+static void copyClipped(void)
+{
+    CursesGui gui(20, 60);
+    CursesRect rect;
+    WINDOW *src, *dst;
+    bool ok;
+
+    src = newwin(4, 10, 0, 0);
+    dst = newwin(10, 20, 5, 5);
+    mvwaddstr(src, 0, 0, "ab");
+    mvwaddstr(src, 1, 0, "cd");
+    rect.y = -1;
+    rect.x = -2;
+    rect.lines = 3;
+    rect.cols = 4;
+    gui.copyRect(src, rect, dst, 3, 4);
+    ok = (mvwinch(dst, 4, 6) & A_CHARTEXT) == 'a'
+	&& (mvwinch(dst, 4, 7) & A_CHARTEXT) == 'b'
+	&& (mvwinch(dst, 5, 6) & A_CHARTEXT) == 'c'
+	&& (mvwinch(dst, 5, 7) & A_CHARTEXT) == 'd'
+	&& (mvwinch(dst, 3, 4) & A_CHARTEXT) == ' ';
+    check("copyRect from a negative origin", ok);
+    delwin(dst);
+    delwin(src);
+}
+
+/***********************************************************************/
+/* Routine: tabBarBorder()                                             */
+/* Purpose: The tabbed viewer's tab row, drawn and cleared again, must */
+/*          leave printBox's border on that row alone.                 */
+/***********************************************************************/
+
+static void tabBarBorder(void)
+{
+    CursesGui gui(20, 60);
+    vector < string > files, rows;
+    string one, two;
+    bool ok;
+
+    one = tempFile("one\n");
+    two = tempFile("two\n");
+    files.push_back(one);
+    files.push_back(two);
+    gui.printBox();
+    gui.pushKey('\t');
+    gui.pushKey(KEY_F(3));
+    gui.fileViewTabs(files);
+    rows = gui.getScreen();
+    ok = rows[1][0] == '|' && rows[1][59] == '|';
+    check("tab bar leaves the border", ok);
+    unlink(one.c_str());
+    unlink(two.c_str());
+}
+
+int main(void)
+{
+    paintThenRefresh();
+    copyClipped();
+    tabBarBorder();
+    return failed;
+}
@@ -3,6 +3,7 @@
 // Date: June 23,2006
 
 #include "ucurses.h"
+#include "uview.h"
 
 #define A_ATTR  (A_ATTRIBUTES ^ A_COLOR)	/* A_BLINK, A_REVERSE, A_BOLD */
 #define TITLECOLOR         1	/* color pair indices */
@@ -21,6 +22,16 @@
 #define REDONWHITE 5
 
 
+#define HEADLESSTERM "xterm"	/* terminal type of the in-memory screen */
+#define HEADLESSWAIT 1000	/* ms a headless read waits once keys run out */
+#define FRAMESCRATCH (1 << 20)	/* frame bytes kept before it is emptied */
+#define SEARCHTICK 100		/* ms between looks at a running search */
+#define WRAPCACHE 65536		/* lines whose wrapped rows are kept */
+#define ROWCACHE (1 << 20)	/* cells of laid out lines kept */
+#define ROWLEAST (64 << 10)	/* cells kept however tight the budget */
+#define ROWSLICE (16 << 10)	/* cells of a long line laid out at once */
+#define VIEWBUDGET (64 << 20)	/* bytes fileViewTabs may take */
+
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 #define CTRLD   4
 
@@ -48,10 +59,113 @@ using namespace std;
 // ------------------------------------------------------------------
 CursesGui::CursesGui()
 {
+    init();
+
+try {
+    // Own the output stream, so writeFrame() can point its
+    // descriptor at the scratch file a frame is gathered in.
+    int fd = dup(STDOUT_FILENO);
+    if (fd != -1)
+	screenOut = fdopen(fd, "w");
+    if (screenOut != NULL)
+	screen = newterm(NULL, screenOut, stdin);
+    if (screen == NULL) {
+	if (screenOut != NULL)
+	    fclose(screenOut);
+	screenOut = NULL;
+	initscr();
+    } else {
+	def_prog_mode();
+	fflush(screenOut);
+    }
+    setup();
+    } 
+    catch( exception const &e)
+    {
+      cerr << "Error: " << e.what() << endl;
+	} 
+
+}
+
+// ------------------------------------------------------------------
+// Constructor: headless screen of lines x cols kept in memory.
+// Output is discarded and input comes from pushKey()/pushKeys(),
+// so widgets can be driven and timed without a terminal.
+// ------------------------------------------------------------------
+CursesGui::CursesGui(int lines, int cols)
+{
+    int fds[2];
+
+    init();
 
 try {
-    initscr();
+    if (pipe(fds) == -1) {
+	cerr << "Error: cannot create the headless input pipe" << endl;
+	return;
+    }
+    keyPipe = fds[1];
+    fcntl(keyPipe, F_SETFL, O_NONBLOCK);
+    screenIn = fdopen(fds[0], "r");
+    screenOut = fopen("/dev/null", "w");
+    screen = newterm((char *) HEADLESSTERM, screenOut, screenIn);
+    if (screen == NULL) {
+	cerr << "Error: cannot open the headless screen" << endl;
+	return;
+    }
+    resizeterm(lines, cols);
+    setup();
+    } 
+    catch( exception const &e)
+    {
+      cerr << "Error: " << e.what() << endl;
+	} 
+
+}
+
+// ------------------------------------------------------------------
+// init: member defaults shared by both constructors
+// ------------------------------------------------------------------
+void CursesGui::init(void)
+{
+    frameDepth = 0;
+    damageTracking = false;
+    screen = NULL;
+    screenIn = NULL;
+    screenOut = NULL;
+    frameFd = -1;
+    frameAt = 0;
+    termFd = -1;
+    keyPipe = -1;
+    bandwidth = 0;
+    tokens = 0;
+    colorsOn = true;
+    pendingFrame = false;
+    sentBytes = 0;
+    skippedFrames = 0;
+    meterBytes = 0;
+    termBytes = termWrites = 0;
+    sentFrames = 0;
+    statsOn = false;
+    callMethod = NULL;
+    callRefresh = 0;
+    keyPending = false;
+    indexCache = false;
+    finder = NULL;
+    wrapOn = true;
+    firstCol = 0;
+    wrapDoc = NULL;
+    wrapWidth = 0;
+    rowLimit = ROWCACHE;
+    rowCells = 0;
+    rowHits = rowMisses = 0;
+    viewBudget = VIEWBUDGET;
+}
 
+// ------------------------------------------------------------------
+// setup: colors and input modes shared by both constructors
+// ------------------------------------------------------------------
+void CursesGui::setup(void)
+{
     if (has_colors())
 	start_color();
     init_pair(TITLECOLOR & ~A_ATTR, COLOR_BLACK, COLOR_CYAN);
@@ -72,12 +186,32 @@ try {
     noecho();
     keypad(stdscr, TRUE);
     assume_default_colors(COLOR_WHITE, COLOR_BLUE);
-    } 
-    catch( exception const &e)
-    {
-      cerr << "Error: " << e.what() << endl;
-	} 
 
+    gettimeofday(&lastFill, NULL);
+
+    // frames are gathered in a scratch file and sent in one write()
+    FILE *scratch = tmpfile();
+    if (scratch != NULL) {
+	frameFd = dup(fileno(scratch));
+	fclose(scratch);
+    }
+    if (frameFd != -1 && screenOut != NULL)
+	termFd = dup(fileno(screenOut));
+
+    // synchronized output when the terminal says it has it
+    char *sync = tigetstr((char *) "Sync");
+    syncBegin = "\033[?2026h";
+    syncEnd = "\033[?2026l";
+    syncOutput = false;
+    if (sync != NULL && sync != (char *) -1) {
+	char *seq = tparm(sync, 1);
+	if (seq != NULL)
+	    syncBegin = seq;
+	seq = tparm(sync, 2);
+	if (seq != NULL)
+	    syncEnd = seq;
+	syncOutput = true;
+    }
 }
 
 // ------------------------------------------------------------------
@@ -91,6 +225,19 @@ CursesGui::~CursesGui()
     clear();
     refresh();
     endwin();
+
+    if (screen != NULL)
+	delscreen(screen);
+    if (screenIn != NULL)
+	fclose(screenIn);
+    if (screenOut != NULL)
+	fclose(screenOut);
+    if (frameFd != -1)
+	close(frameFd);
+    if (termFd != -1)
+	close(termFd);
+    if (keyPipe != -1)
+	close(keyPipe);
 }
 
 
@@ -104,9 +251,10 @@ CursesGui::~CursesGui()
 
 void CursesGui::printAt(int x, int y, std::string text)
 {
-    move(x, y);
-    printw("%s", text.c_str());
-    refresh();
+    CallScope scope(this, "printAt");
+
+    mvwaddnstr(stdscr, x, y, text.c_str(), text.size());
+    refreshWin(stdscr);
 }
 
 
@@ -119,6 +267,8 @@ void CursesGui::printAt(int x, int y, std::string text)
 
 void CursesGui::printAt(int x, int y, int nInt)
 {
+    CallScope scope(this, "printAt");
+
     stringstream ss;
     ss << nInt;
     printAt(x, y, ss.str().c_str());
@@ -132,9 +282,11 @@ void CursesGui::printAt(int x, int y, int nInt)
 /***********************************************************************/
 void CursesGui::printAtWindow(WINDOW * myWindow, int x, int y, string text)
 {
-    mvwprintw(myWindow, y, x, "%s", text.c_str());
+    CallScope scope(this, "printAtWindow");
+
+    mvwaddnstr(myWindow, y, x, text.c_str(), text.size());
     touchwin(myWindow);
-    wrefresh(myWindow);
+    refreshWin(myWindow, true);
 }
 
 
@@ -148,11 +300,15 @@ void CursesGui::printAtWindow(WINDOW * myWindow, int x, int y, string text)
 WINDOW *CursesGui::newWindow(int startx, int starty, int numLines,
 			     int numCols, char boxChary, char boxCharx)
 {
+    CallScope scope(this, "newWindow");
+
     WINDOW *myWin;
     myWin = newwin(numLines, numCols, startx, starty);
     box(myWin, boxChary, boxCharx);
-    refresh();
-    wrefresh(myWin);
+    beginFrame();
+    refreshWin(stdscr);
+    refreshWin(myWin, true);
+    endFrame();
     return myWin;
 }
 
@@ -167,10 +323,14 @@ WINDOW *CursesGui::newWindow(int startx, int starty, int numLines,
 WINDOW *CursesGui::newWindow(int startx, int starty, int numLines,
 			     int numCols)
 {
+    CallScope scope(this, "newWindow");
+
     WINDOW *myWin;
     myWin = newwin(numLines, numCols, startx, starty);
-    refresh();
-    wrefresh(myWin);
+    beginFrame();
+    refreshWin(stdscr);
+    refreshWin(myWin, true);
+    endFrame();
     return myWin;
 }
 
@@ -183,8 +343,11 @@ WINDOW *CursesGui::newWindow(int startx, int starty, int numLines,
 
 void CursesGui::moveWindow(WINDOW * myWin, int x, int y)
 {
+    CallScope scope(this, "moveWindow");
+
+    forget(myWin);
     mvwin(myWin, y, x);
-    wrefresh(myWin);
+    refreshWin(myWin);
 }
 
 
@@ -196,6 +359,7 @@ void CursesGui::moveWindow(WINDOW * myWin, int x, int y)
 
 void CursesGui::delWindow(WINDOW * myWin)
 {
+    forget(myWin);
     delwin(myWin);
 }
 
@@ -228,6 +392,7 @@ int CursesGui::newMenu(char const *options[], int n_choices)
 
 int CursesGui::showMenu(int menu)
 {
+    CallScope scope(this, "showMenu");
 
     ITEM **my_items;
     int c;
@@ -267,7 +432,7 @@ int CursesGui::showMenu(int menu)
     my_menu_win =
 	newwin(winsizey, winsizex, (LINES / 3) - 4, (COLS - winsizex) / 2);
     wborder(my_menu_win, '|', '|', '-', '-', '+', '+', '+', '+');
-    wrefresh(my_menu_win);
+    paint(my_menu_win);
     keypad(my_menu_win, TRUE);
 
     /* Set main window and sub window */
@@ -283,17 +448,17 @@ int CursesGui::showMenu(int menu)
     /* Print a border around the main window and print a title */
 
     /* MATCH MENU'S COLORS TO THAT OF ITS WINDOWS */
-    set_menu_fore(my_menu, COLOR_PAIR(BLACKONCYAN));
-    set_menu_back(my_menu, COLOR_PAIR(BLACKONCYAN) | WA_BOLD);
+    set_menu_fore(my_menu, colorAttr(COLOR_PAIR(BLACKONCYAN), A_REVERSE));
+    set_menu_back(my_menu, colorAttr(COLOR_PAIR(BLACKONCYAN) | WA_BOLD));
 
     setcolor(my_menu_win, BLACKONCYAN);
 
     mvwprintw(my_menu_win, winsizey + 2, 1, "F3 = Exit");
-    refresh();
+    paint(stdscr);
     post_menu(my_menu);
-    wrefresh(my_menu_win);
+    paint(my_menu_win);
 
-    while (((c = getch()) != 10)) {
+    while (((c = readKey(stdscr)) != 10)) {
 	switch (c) {
 	case KEY_DOWN:
 	    menu_driver(my_menu, REQ_DOWN_ITEM);
@@ -310,7 +475,8 @@ int CursesGui::showMenu(int menu)
 	    quit = 1;
 	    break;
 	}
-	wrefresh(my_menu_win);
+	paint(my_menu_win);
+	keyPainted("showMenu");
 
 	if (quit)
 	    break;
@@ -327,13 +493,15 @@ int CursesGui::showMenu(int menu)
     wclear(my_menu_win);
     wclear(my_sub_win);
 
-    wrefresh(my_menu_win);
-    wrefresh(my_sub_win);
+    paint(my_menu_win);
+    paint(my_sub_win);
 
+    forget(my_menu_win);
     delwin(my_menu_win);
     delwin(my_sub_win);
 
-    refresh();
+    paint(stdscr);
+    keyPainted("showMenu");
 
     return option;
 }
@@ -349,6 +517,8 @@ int CursesGui::showMenu(int menu)
 void CursesGui::print_in_middle(WINDOW * win, int starty, int startx,
 				int width, char const *string, chtype color)
 {
+    CallScope scope(this, "print_in_middle");
+
     int length, x, y;
     float temp;
 
@@ -365,10 +535,11 @@ void CursesGui::print_in_middle(WINDOW * win, int starty, int startx,
     length = strlen(string);
     temp = (width - length) / 2;
     x = startx + (int) temp;
+    color = colorAttr(color);
     wattron(win, color);
-    mvwprintw(win, y, x, "%s", string);
+    mvwaddnstr(win, y, x, string, length);
     wattroff(win, color);
-    refresh();
+    refreshWin(stdscr);
 }
 
 
@@ -381,6 +552,7 @@ void CursesGui::print_in_middle(WINDOW * win, int starty, int startx,
 void CursesGui::print_centered(int starty, int startx,
 			       char const *string, chtype color)
 {
+    CallScope scope(this, "print_centered");
 
     int length, x, y, width;
     float temp;
@@ -392,9 +564,9 @@ void CursesGui::print_centered(int starty, int startx,
     temp = (width - length) / 2;
     x = x + (int) temp;
     attron(A_REVERSE);
-    mvprintw(y, x, "%s", string);
+    mvwaddnstr(stdscr, y, x, string, length);
     attroff(A_REVERSE);
-    refresh();
+    refreshWin(stdscr);
 
 }
 
@@ -406,19 +578,21 @@ void CursesGui::print_centered(int starty, int startx,
 
 void CursesGui::printBox(void)
 {
+    CallScope scope(this, "printBox");
+
   try {
 
     chtype color = COLOR_PAIR(3);
     chtype attr = color & A_ATTR;	/* extract Bold, Reverse, Blink bits */
     attr &= ~A_REVERSE;		/* ignore reverse, use colors instead! */
-    attrset(COLOR_PAIR(color & A_CHARTEXT) | attr);
+    attrset(colorAttr(COLOR_PAIR(color & A_CHARTEXT) | attr));
     if (has_colors())
-	bkgd(COLOR_PAIR(color & A_CHARTEXT) | (attr & ~A_REVERSE));
+	bkgd(colorAttr(COLOR_PAIR(color & A_CHARTEXT) | (attr & ~A_REVERSE)));
     else
 	bkgd(color);
     erase();
     border('|', '|', '-', '-', '+', '+', '+', '+');
-    refresh();
+    refreshWin(stdscr, true);
     }
 	catch(exception const &e)
 	{
@@ -435,6 +609,8 @@ void CursesGui::printBox(void)
 
 void CursesGui::printTitle(string title)
 {
+    CallScope scope(this, "printTitle");
+
     print_centered(0, 1, (char const*) title.c_str(), A_STANDOUT);
 }
 
@@ -448,18 +624,25 @@ void CursesGui::printTitle(string title)
 
 void CursesGui::colorbox(WINDOW * win, chtype color, int hasbox)
 {
+    CallScope scope(this, "colorbox");
 
     chtype attr = color & A_ATTR;	/* extract Bold, Reverse, Blink bits */
+    chtype bkgd;
+    CursesRect all = { 0, 0, getmaxy(win), getmaxx(win) };
+
     setcolor(win, color);
     if (has_colors())
-	wbkgd(win, COLOR_PAIR(color & A_CHARTEXT) | (attr & ~A_REVERSE));
+	wbkgd(win,
+	      colorAttr(COLOR_PAIR(color & A_CHARTEXT) | (attr & ~A_REVERSE)));
     else
 	wbkgd(win, color);
-    werase(win);
+    bkgd = getbkgd(win);
+    fillRect(win, all, bkgd & A_CHARTEXT, bkgd & ~A_CHARTEXT);
+    wmove(win, 0, 0);
     if (hasbox && win->_maxy > 2)
-	box(win, 0, 0);
+	frame(win);
     touchwin(win);
-    wrefresh(win);
+    refreshWin(win, true);
 }
 
 /***********************************************************************/
@@ -470,12 +653,11 @@ void CursesGui::colorbox(WINDOW * win, chtype color, int hasbox)
 
 void CursesGui::setcolor(WINDOW * win, chtype color)
 {
-    chtype attr = color & A_ATTR;	/* extract Bold, Reverse, Blink bits   */
-    attr &= ~A_REVERSE;		/* ignore reverse, use colors instead! */
-    wattrset(win, COLOR_PAIR(color & A_CHARTEXT) | attr);
-    wattrset(win, COLOR_PAIR(color) | WA_BOLD);
+    CallScope scope(this, "setcolor");
+
+    wattrset(win, colorAttr(COLOR_PAIR(color) | WA_BOLD));
     wclrscr(win);
-    box(win, 0, 0);
+    frame(win);
     wCenterTitle(win, "");
 }
 
@@ -487,6 +669,8 @@ void CursesGui::setcolor(WINDOW * win, chtype color)
 
 void CursesGui::messageBox(string texto)
 {
+    CallScope scope(this, "messageBox");
+
     ITEM **my_items;
     int c;
     MENU *my_menu;
@@ -520,17 +704,17 @@ void CursesGui::messageBox(string texto)
 
 
     /* Print a border around the main window and print a title */
-    set_menu_fore(my_menu, COLOR_PAIR(BLACKONCYAN) | WA_REVERSE);
-    set_menu_back(my_menu, COLOR_PAIR(BLACKONCYAN) | WA_BOLD);
+    set_menu_fore(my_menu, colorAttr(COLOR_PAIR(BLACKONCYAN) | WA_REVERSE));
+    set_menu_back(my_menu, colorAttr(COLOR_PAIR(BLACKONCYAN) | WA_BOLD));
     setcolor(my_menu_win, BLACKONCYAN);
 
     print_in_middle(my_menu_win, 1, 1, strlen(texto.c_str()) + 8,
 		    (char const*) texto.c_str(),
 		    COLOR_PAIR(BLACKONCYAN) | WA_BOLD);
     post_menu(my_menu);
-    wrefresh(my_menu_win);
+    paint(my_menu_win);
 
-    while ((c = getch()) != 10) {
+    while ((c = readKey(stdscr)) != 10) {
 	switch (c) {
 	case KEY_DOWN:
 	    menu_driver(my_menu, REQ_DOWN_ITEM);
@@ -539,7 +723,8 @@ void CursesGui::messageBox(string texto)
 	    menu_driver(my_menu, REQ_UP_ITEM);
 	    break;
 	}
-	wrefresh(my_menu_win);
+	paint(my_menu_win);
+	keyPainted("messageBox");
     }
 
     free_menu(my_menu);
@@ -550,9 +735,11 @@ void CursesGui::messageBox(string texto)
     wclear(my_menu_win);
     wclear(my_sub_win);
 
-    wrefresh(my_menu_win);
-    wrefresh(my_sub_win);
+    paint(my_menu_win);
+    paint(my_sub_win);
+    keyPainted("messageBox");
 
+    forget(my_menu_win);
     delwin(my_menu_win);
     delwin(my_sub_win);
 
@@ -569,6 +756,8 @@ void CursesGui::messageBox(string texto)
 
 int CursesGui::yesno(string texto)
 {
+    CallScope scope(this, "yesno");
+
     ITEM **my_items;
     int c;
     MENU *my_menu;
@@ -613,16 +802,16 @@ int CursesGui::yesno(string texto)
     set_menu_mark(my_menu, 0);
 
     /* Print a border around the main window and print a title */
-    set_menu_fore(my_menu, COLOR_PAIR(BLACKONCYAN) | WA_REVERSE);
-    set_menu_back(my_menu, COLOR_PAIR(BLACKONCYAN));
+    set_menu_fore(my_menu, colorAttr(COLOR_PAIR(BLACKONCYAN) | WA_REVERSE));
+    set_menu_back(my_menu, colorAttr(COLOR_PAIR(BLACKONCYAN)));
     setcolor(my_menu_win, BLACKONCYAN);
 
     print_in_middle(my_menu_win, 1, 1, colSize + 2,
 		    (char const*) texto.c_str(), COLOR_PAIR(BLACKONCYAN));
     post_menu(my_menu);
-    wrefresh(my_menu_win);
+    paint(my_menu_win);
 
-    while ((c = getch()) != 10) {
+    while ((c = readKey(stdscr)) != 10) {
 	switch (c) {
 	case KEY_DOWN:
 	    menu_driver(my_menu, REQ_DOWN_ITEM);
@@ -637,7 +826,8 @@ int CursesGui::yesno(string texto)
 	    menu_driver(my_menu, REQ_RIGHT_ITEM);
 	    break;
 	}
-	wrefresh(my_menu_win);
+	paint(my_menu_win);
+	keyPainted("yesno");
     }
     ITEM *cur;
     cur = current_item(my_menu);
@@ -652,9 +842,11 @@ int CursesGui::yesno(string texto)
     wclear(my_menu_win);
     wclear(my_sub_win);
 
-    wrefresh(my_menu_win);
-    wrefresh(my_sub_win);
+    paint(my_menu_win);
+    paint(my_sub_win);
+    keyPainted("yesno");
 
+    forget(my_menu_win);
     delwin(my_menu_win);
     delwin(my_sub_win);
 
@@ -664,7 +856,10 @@ int CursesGui::yesno(string texto)
 
 void CursesGui::wait_for_key(void)
 {
+    CallScope scope(this, "wait_for_key");
+
  try {
+    flushFrame();
 
   char c;
     cin.get(c);
@@ -694,6 +889,8 @@ void CursesGui::helloworld(void)
 
 string CursesGui::dialogBox(string texto, int nsize)
 {
+    CallScope scope(this, "dialogBox");
+
     FIELD *field[2];
     FORM *my_form;
     int ch;
@@ -740,24 +937,24 @@ string CursesGui::dialogBox(string texto, int nsize)
 
     setcolor(my_form_win, BLACKONCYAN);
 
-    wbkgd(my_sub_win, COLOR_PAIR(BLACKONCYAN & A_CHARTEXT));
+    wbkgd(my_sub_win, colorAttr(COLOR_PAIR(BLACKONCYAN & A_CHARTEXT)));
 
     set_field_fore(field[0],
-		   COLOR_PAIR(BLACKONCYAN) | A_UNDERLINE | A_REVERSE);
+		   colorAttr(COLOR_PAIR(BLACKONCYAN) | A_UNDERLINE | A_REVERSE));
     set_field_back(field[0],
-		   COLOR_PAIR(BLACKONCYAN) | A_UNDERLINE | A_REVERSE);
+		   colorAttr(COLOR_PAIR(BLACKONCYAN) | A_UNDERLINE | A_REVERSE));
     set_field_pad(field[0],
-		  COLOR_PAIR(BLACKONCYAN) | A_UNDERLINE | A_REVERSE);
+		  colorAttr(COLOR_PAIR(BLACKONCYAN) | A_UNDERLINE | A_REVERSE));
 
     print_in_middle(my_form_win, 1, 1, colSize + 2,
 		    (char const*) texto.c_str(), COLOR_PAIR(BLACKONCYAN));
 
     post_form(my_form);
-    wrefresh(my_form_win);
+    paint(my_form_win);
 
 
     /* Loop through to get user requests */
-    while ((ch = wgetch(my_form_win)) != 10) {
+    while ((ch = readKey(my_form_win)) != 10) {
 	switch (ch) {
 	case KEY_BACKSPACE:
 	    form_driver(my_form, REQ_DEL_PREV);
@@ -777,18 +974,21 @@ string CursesGui::dialogBox(string texto, int nsize)
 	    form_driver(my_form, ch);
 	    break;
 	}
-
+	paint(my_form_win);
+	keyPainted("dialogBox");
     }
 
     form_driver(my_form, REQ_END_LINE);
     string response(field_buffer(field[0], 0));
 
-    refresh();
+    paint(stdscr);
     wclear(my_form_win);
     wclear(my_sub_win);
 
-    wrefresh(my_form_win);
-    wrefresh(my_sub_win);
+    paint(my_form_win);
+    paint(my_sub_win);
+    keyPainted("dialogBox");
+    forget(my_form_win);
 
 
     /* Un post form and free the memory */
@@ -810,11 +1010,154 @@ string CursesGui::dialogBox(string texto, int nsize)
 /***********************************************************************/
 void CursesGui::wclrscr(WINDOW * pwin)
 {
-    int y, x, maxy, maxx;
-    getmaxyx(pwin, maxy, maxx);
-    for (y = 0; y < maxy; y++)
-	for (x = 0; x < maxx; x++)
-	    mvwaddch(pwin, y, x, ' ');
+    CursesRect all = { 0, 0, getmaxy(pwin), getmaxx(pwin) };
+
+    chtype blank = blankCell(pwin);
+
+    fillRect(pwin, all, blank & A_CHARTEXT, blank & ~A_CHARTEXT);
+}
+
+/***********************************************************************/
+/* Routine: fillRect(WINDOW,rect,ch,attr)                              */
+/* Purpose: To fill a rectangle of a window with one character. A row  */
+/*          of cells is built once and written with one counted call   */
+/*          per line instead of one waddch per cell.                   */
+/***********************************************************************/
+void CursesGui::fillRect(WINDOW * win, CursesRect rect, chtype ch,
+			 chtype attr)
+{
+    int y;
+
+    if (!clipRect(win, rect))
+	return;
+    if ((ch & A_CHARTEXT) == 0)
+	ch = ' ';
+    vector < chtype > row(rect.cols, ch | attr);
+    for (y = rect.y; y < rect.y + rect.lines; y++)
+	mvwaddchnstr(win, y, rect.x, &row[0], rect.cols);
+}
+
+/***********************************************************************/
+/* Routine: blitText(WINDOW,rect,rows)                                 */
+/* Purpose: To write lines of text into a rectangle, one counted call  */
+/*          per line, padding short lines with blanks. Text takes the  */
+/*          attributes waddstr would give it.                          */
+/***********************************************************************/
+void CursesGui::blitText(WINDOW * win, CursesRect rect,
+			 const vector < string > &rows)
+{
+    int y, x, n, top, skip;
+    chtype attr, blank;
+
+    top = rect.y;
+    skip = rect.x;
+    if (!clipRect(win, rect))
+	return;
+    /* columns clipped off on the left are skipped in each line too */
+    skip = rect.x - skip;
+    attr = cellAttr(win);
+    blank = blankCell(win);
+    vector < chtype > row(rect.cols);
+    for (y = rect.y; y < rect.y + rect.lines; y++) {
+	n = 0;
+	if (y - top < (int) rows.size()
+	    && (int) rows[y - top].size() > skip) {
+	    const string & text = rows[y - top];
+	    n = (int) text.size() - skip;
+	    if (n > rect.cols)
+		n = rect.cols;
+	    for (x = 0; x < n; x++) {
+		unsigned char c = text[skip + x];
+		row[x] = (c < ' ' || c == 127 ? ' ' : c) | attr;
+	    }
+	}
+	fill(row.begin() + n, row.end(), blank);
+	mvwaddchnstr(win, y, rect.x, &row[0], rect.cols);
+    }
+}
+
+/***********************************************************************/
+/* Routine: copyRect(WINDOW,rect,WINDOW,y,x)                           */
+/* Purpose: To copy a rectangle of cells, attributes included, from    */
+/*          one window to another, a line at a time. What is clipped  */
+/*          off either window is left out at both ends.                */
+/***********************************************************************/
+void CursesGui::copyRect(WINDOW * src, CursesRect rect, WINDOW * dst,
+			 int y, int x)
+{
+    int row, origY, origX;
+    CursesRect to;
+
+    origY = rect.y;
+    origX = rect.x;
+    if (!clipRect(src, rect))
+	return;
+    y += rect.y - origY;
+    x += rect.x - origX;
+    to.y = y;
+    to.x = x;
+    to.lines = rect.lines;
+    to.cols = rect.cols;
+    if (!clipRect(dst, to))
+	return;
+    rect.y += to.y - y;
+    rect.x += to.x - x;
+    vector < chtype > cells(to.cols + 1);
+    for (row = 0; row < to.lines; row++) {
+	mvwinchnstr(src, rect.y + row, rect.x, &cells[0], to.cols);
+	mvwaddchnstr(dst, to.y + row, to.x, &cells[0], to.cols);
+    }
+}
+
+/***********************************************************************/
+/* Routine: clipRect(WINDOW,rect)                                      */
+/* Purpose: To clip a rectangle to a window. False if nothing is left. */
+/***********************************************************************/
+bool CursesGui::clipRect(WINDOW * win, CursesRect & rect)
+{
+    int maxy, maxx;
+
+    getmaxyx(win, maxy, maxx);
+    if (rect.y < 0) {
+	rect.lines += rect.y;
+	rect.y = 0;
+    }
+    if (rect.x < 0) {
+	rect.cols += rect.x;
+	rect.x = 0;
+    }
+    if (rect.y + rect.lines > maxy)
+	rect.lines = maxy - rect.y;
+    if (rect.x + rect.cols > maxx)
+	rect.cols = maxx - rect.x;
+    return rect.lines > 0 && rect.cols > 0;
+}
+
+/***********************************************************************/
+/* Routine: cellAttr(WINDOW)                                           */
+/* Purpose: The attributes waddch gives a character in this window:    */
+/*          the current and background attributes together, colored    */
+/*          by the background if the current ones carry no color.      */
+/***********************************************************************/
+chtype CursesGui::cellAttr(WINDOW * win)
+{
+    chtype attr = getattrs(win);
+    chtype bkgd = getbkgd(win);
+
+    if ((attr & A_COLOR) != 0)
+	bkgd &= ~A_COLOR;
+    return (attr | bkgd) & ~A_CHARTEXT;
+}
+
+/***********************************************************************/
+/* Routine: blankCell(WINDOW)                                          */
+/* Purpose: The cell waddch(' ') leaves in this window.                */
+/***********************************************************************/
+chtype CursesGui::blankCell(WINDOW * win)
+{
+    chtype ch = getbkgd(win) & A_CHARTEXT;
+
+    return (ch != 0 ? ch : ' ') | cellAttr(win);
 }
 
 /***********************************************************************/
@@ -828,40 +1171,267 @@ void CursesGui::wCenterTitle(WINDOW * pwin, const char *title)
     getmaxyx(pwin, maxy, maxx);
     stringsize = 4 + strlen(title);
     x = (maxx - stringsize) / 2;
-    mvwaddch(pwin, 0, x, ACS_RTEE);
+    mvwaddch(pwin, 0, x, bandwidth > 0 ? '[' : ACS_RTEE);
     waddch(pwin, ' ');
     waddstr(pwin, title);
     waddch(pwin, ' ');
-    waddch(pwin, ACS_LTEE);
+    waddch(pwin, bandwidth > 0 ? ']' : ACS_LTEE);
 }
 
 /***********************************************************************/
 /* Routine: fileView(fname)                                            */
-/* Purpose: To show a file in a screen                                 */
+/* Purpose: To show a file in a screen. A gzip file is shown inflated. */
 /*                                                                     */
 /***********************************************************************/
 
 int CursesGui::fileView(string fname)
 {
-    int cnt, option;
+    CallScope scope(this, "fileView");
 
-    ifstream myfile;
-    string data, line;
+    return viewFile(fname, false);
+}
+
+/***********************************************************************/
+/* Routine: fileFollow(fname)                                          */
+/* Purpose: To show a file and keep showing it as it grows, like       */
+/*          tail -F: rows appended while the end is on screen scroll   */
+/*          in at the bottom, and a file truncated or rotated away is  */
+/*          shown anew from the top.                                   */
+/***********************************************************************/
+
+int CursesGui::fileFollow(string fname)
+{
+    CallScope scope(this, "fileFollow");
+
+    return viewFile(fname, true);
+}
 
-    cnt = countLines(fname.c_str());
-    myfile.open(fname.c_str());
+/***********************************************************************/
+/* Routine: fileViewTabs(fnames)                                       */
+/* Purpose: To show several files at once, a tab for each, named on a  */
+/*          bar above them. Tab and Shift-Tab go to the next and the   */
+/*          previous one, which comes back as it was left: nothing is  */
+/*          read again. The line indexes of all the files and the      */
+/*          lines kept laid out share viewBudget bytes; the lines kept */
+/*          give way as the indexes grow, each time a tab is shown.    */
+/***********************************************************************/
 
-    if (myfile.is_open()) {
+int CursesGui::fileViewTabs(vector < string > fnames)
+{
+    CallScope scope(this, "fileViewTabs");
+    vector < ViewTab > tabs(fnames.size());
+    unsigned long limit;
+    size_t i, cur;
+    int ch;
 
-	while (!myfile.eof()) {
-	    getline(myfile, line);
-	    data.append(line);
-	    data.append("\n");
-	}			/* End while */
+    if (tabs.empty())
+	return ERR;
+    for (i = 0; i < tabs.size(); i++) {
+	tabs[i].name = fnames[i];
+	openTab(tabs[i]);
     }
-    myfile.close();
-    option = view(data, cnt);
-    return option;
+    limit = rowLimit;
+    cur = 0;
+    do {
+	fitBudget(tabs);
+	tabBar(tabs, cur);
+	ch = view(*tabs[cur].doc, &tabs[cur]);
+	if (ch == '\t')
+	    cur = (cur + 1) % tabs.size();
+	else if (ch == KEY_BTAB)
+	    cur = (cur + tabs.size() - 1) % tabs.size();
+    } while (ch == '\t' || ch == KEY_BTAB);
+    for (i = 0; i < tabs.size(); i++)
+	closeTab(tabs[i]);
+    rowLimit = limit;
+    trimRows();
+    mvwhline(stdscr, 1, 1, ' ', COLS - 2);
+    paint(stdscr);
+    return ch;
+}
+
+/***********************************************************************/
+/* Routine: openTab(tab) / closeTab(tab)                               */
+/* Purpose: To open a tab's file the way fileView does, gzip inflated  */
+/*          and binary in hex, and to close it again, saving its line  */
+/*          index for the next time.                                   */
+/***********************************************************************/
+
+void CursesGui::openTab(ViewTab & tab)
+{
+    GzipFile *gz;
+    const char *text;
+    size_t len;
+
+    tab.file = NULL;
+    tab.top_line = 0;
+    tab.top_sub = 0;
+    tab.wrap = true;
+    tab.firstCol = 0;
+    if (GzipFile::isGzip(tab.name)) {
+	gz = new GzipFile;
+	gz->open(tab.name);
+	tab.doc = gz;
+    } else {
+	tab.file = new MappedFile;
+	if (tab.file->open(tab.name) && indexCache) {
+	    tab.cache = tab.file->sidecar(indexDir);
+	    tab.file->loadIndex(tab.cache);
+	}
+	text = tab.file->text(len);
+	if (len > 0
+	    && memchr(text, '\0', len < INDEXBLOCK ? len : INDEXBLOCK) != NULL)
+	    tab.doc = new HexDocument(*tab.file,
+				      HexDocument::rowBytes(COLS - 7));
+	else
+	    tab.doc = tab.file;
+    }
+    tab.search = new Search(*tab.doc);
+}
+
+void CursesGui::closeTab(ViewTab & tab)
+{
+    delete tab.search;
+    forgetRows(*tab.doc, 0);
+    if (tab.doc != tab.file)
+	delete tab.doc;
+    else if (!tab.cache.empty())
+	tab.file->saveIndex(tab.cache);
+    delete tab.file;
+}
+
+/***********************************************************************/
+/* Routine: tabBar(tabs,current)                                       */
+/* Purpose: To name the tabs on the row above the view, the one shown  */
+/*          in reverse. It goes out with the view's first frame.       */
+/***********************************************************************/
+
+void CursesGui::tabBar(const vector < ViewTab > &tabs, size_t current)
+{
+    char label[64];
+    const char *name;
+    size_t i;
+    int x;
+
+    mvwhline(stdscr, 1, 1, ' ', COLS - 2);
+    for (i = 0; i < tabs.size(); i++) {
+	name = strrchr(tabs[i].name.c_str(), '/');
+	name = name != NULL ? name + 1 : tabs[i].name.c_str();
+	snprintf(label, sizeof(label), " %lu:%s ", (unsigned long) i + 1,
+		 name);
+	x = getcurx(stdscr);
+	if (x >= COLS - 1)
+	    break;
+	if (i == current)
+	    wattron(stdscr, A_REVERSE);
+	waddnstr(stdscr, label, COLS - 1 - x);
+	if (i == current)
+	    wattroff(stdscr, A_REVERSE);
+    }
+    damage(stdscr, false);
+    wnoutrefresh(stdscr);
+}
+
+/***********************************************************************/
+/* Routine: fitBudget(tabs) / setViewBudget(bytes)                     */
+/* Purpose: To give the lines kept laid out what the tabs' indexes     */
+/*          leave of viewBudget, and never fewer than ROWLEAST cells.  */
+/***********************************************************************/
+
+void CursesGui::fitBudget(vector < ViewTab > &tabs)
+{
+    unsigned long used;
+    size_t i;
+
+    used = 0;
+    for (i = 0; i < tabs.size(); i++) {
+	used += tabs[i].doc->memory();
+	if (tabs[i].file != NULL && tabs[i].file != tabs[i].doc)
+	    used += tabs[i].file->memory();
+    }
+    rowLimit = used < viewBudget ? (viewBudget - used) / sizeof(chtype) : 0;
+    if (rowLimit < ROWLEAST)
+	rowLimit = ROWLEAST;
+    trimRows();
+}
+
+void CursesGui::setViewBudget(unsigned long bytes)
+{
+    viewBudget = bytes;
+}
+
+int CursesGui::viewFile(string fname, bool follow)
+{
+    MappedFile doc;
+    string cache;
+    const char *text;
+    size_t len;
+    int ch;
+
+    /* a gzip file is inflated as it is read, and is never followed */
+    if (GzipFile::isGzip(fname)) {
+	GzipFile gz;
+
+	gz.open(fname);
+	return view(gz);
+    }
+    /* A file that cannot be opened shows as an empty one. */
+    if (doc.open(fname) && indexCache) {
+	cache = doc.sidecar(indexDir);
+	doc.loadIndex(cache);
+    }
+
+    /* one with a NUL near the start is taken for binary, shown in hex */
+    text = doc.text(len);
+    if (!follow && len > 0
+	&& memchr(text, '\0', len < INDEXBLOCK ? len : INDEXBLOCK) != NULL) {
+	HexDocument hex(doc, HexDocument::rowBytes(COLS - 7));
+
+	return view(hex);
+    }
+    if (follow && !doc.watch())
+	cerr << "Error: cannot follow " << fname << endl;
+    ch = view(doc);
+    if (!cache.empty())
+	doc.saveIndex(cache);
+    return ch;
+}
+
+/***********************************************************************/
+/* Routine: fileViewFilter(fname,regex)                                */
+/* Purpose: To show only the lines of a file that match an extended    */
+/*          regular expression. They are found in the background, so   */
+/*          the first screen is up as soon as it has lines to show.    */
+/***********************************************************************/
+
+int CursesGui::fileViewFilter(string fname, string regex)
+{
+    CallScope scope(this, "fileViewFilter");
+
+    MappedFile doc;
+
+    doc.open(fname);
+    FilterDocument filter(doc);
+    if (!filter.start(regex)) {
+	cerr << "Error: bad regular expression " << regex << endl;
+	return -1;
+    }
+    return view(filter);
+}
+
+/***********************************************************************/
+/* Routine: setIndexCache(on,dir)                                      */
+/* Purpose: fileView keeps the line index of files big enough to take  */
+/*          a while to index, so the next open of the same file, or of */
+/*          the same file grown since, need not index it again. It is  */
+/*          off until turned on here. The index lives in dir, or as a  */
+/*          hidden file next to the file when dir is empty.            */
+/***********************************************************************/
+
+void CursesGui::setIndexCache(bool on, string dir)
+{
+    indexCache = on;
+    indexDir = dir;
 }
 
 /***********************************************************************/
@@ -872,25 +1442,12 @@ int CursesGui::fileView(string fname)
 
 int CursesGui::fileViewIPC(string fname)
 {
-    int cnt, option;
-
-    ifstream myfile;
-    string data, line;
+    CallScope scope(this, "fileViewIPC");
 
-    cnt = countLines(fname.c_str());
-    myfile.open(fname.c_str());
+    MappedFile doc;
 
-    if (myfile.is_open()) {
-
-	while (!myfile.eof()) {
-	    getline(myfile, line);
-	    data.append(line);
-	    data.append("\n");
-	}			/* End while */
-    }
-    myfile.close();
-    option = viewN(data, cnt);
-    return option;
+    doc.open(fname);
+    return viewN(doc);
 }
 
 
@@ -904,10 +1461,10 @@ int CursesGui::fileViewIPC(string fname)
 
 int CursesGui::execView(string cmd)
 {
+    CallScope scope(this, "execView");
 
     FILE *read_fp;
     char buffer[BUFSIZ + 1];
-    int lines;
     string cmdOut;
 
 
@@ -920,9 +1477,9 @@ int CursesGui::execView(string cmd)
 	    memset(buffer, '\0', sizeof(buffer));
 	}
 
-	lines = countChars(cmdOut);
-	view(cmdOut, lines);
 	pclose(read_fp);
+	TextDocument doc(cmdOut);
+	view(doc);
 	return (EXIT_SUCCESS);
     }
     return (EXIT_FAILURE);
@@ -930,197 +1487,1062 @@ int CursesGui::execView(string cmd)
 
 
 /***********************************************************************/
-/* Routine: view(string,lines)                                         */
-/* Purpose: To show a string data in a window                          */
-/*                                                                     */
+/* Routine: view(doc)                                                  */
+/* Purpose: To show a document in a window. Only the rows on screen    */
+/*          are ever laid out: each is made from its line as it comes  */
+/*          into view, so memory does not grow with the document. Once */
+/*          the first screen is up the rest is indexed in the          */
+/*          background, and the line count and scroll bar follow it.   */
+/*          Keys: arrows scroll a row, PgUp/PgDn a screen, Home/End go */
+/*          to either end, g goes to a line and t to a time, found by  */
+/*          binary search in a time-ordered log. / and ? search down   */
+/*          and up, n and N go to the next match either way. Searches  */
+/*          run in the background; keys are read with a timeout while */
+/*          one does, to show matches as they are found. & shows only  */
+/*          the lines matching a regular expression, in a view of its  */
+/*          own that fills in as they are found; Backspace leaves it.  */
+/*          x shows the bytes as a hex dump, the same way.             */
+/*          A followed file is looked at on the same timeout. w turns  */
+/*          wrapping off and on; when off, left and right scroll       */
+/*          across by half a window. Shown as a tab, the view starts   */
+/*          where the tab was left and Tab and Shift-Tab leave it,     */
+/*          keeping its place, its search and its rows laid out.       */
 /***********************************************************************/
 
-int CursesGui::view(string data, int lines)
+int CursesGui::view(Document & doc, ViewTab * tab)
 {
-    int ch;
-    WINDOW *my_form_win, *my_pad_win;
-    string line;
+    int ch, i, rows, top_sub, bot_sub, col, change;
+    long top_line, bot_line, total, n;
+    bool jump, border, seeking, seek_up, at_end, wrap;
+    unsigned long shown;
+    off_t match, seek_at;
+    string answer, note, warn;
+    char progress[32];
+    LineTime when;
+    WINDOW *my_form_win, *my_view_win;
+    vector < chtype > cells;
+    unique_ptr < Search > own;
+
+    /* a tab keeps its search across switches; a lone view has its own */
+    if (tab == NULL)
+	own.reset(new Search(doc));
+    Search & search = tab != NULL ? *tab->search : *own;
 
     keypad(stdscr, TRUE);
 
     int winlines = LINES - 4;
     int wincols = COLS - 2;
-    int subwincols = COLS - 5;
     int subwinlines = LINES - 7;
+    int viewlines = subwinlines - 2;
+    int viewcols = COLS - 6;
+    int width = wincols - 5;
 
-    my_pad_win = newpad(lines * 3, wincols - 5);
     my_form_win = newwin(winlines, wincols, 2, 1);
     keypad(my_form_win, TRUE);
 
-    int index, cnt;
-    unsigned int x;
-    string mysubstr;
-    index = 0;
-    x = 0;
-    cnt = 0;
-
-    while (x < data.size()) {
-	x = data.find("\n", index);
-	mysubstr = data.substr(index, (x - index));
-	index = x;
-	index++;
-	mvwprintw(my_pad_win, cnt, 0, " %s", mysubstr.c_str());
-	int sum = strlen(mysubstr.c_str()) / wincols + 1;
-	cnt = cnt + sum;
-	mysubstr.clear();
-    }
+    /* The visible rows live in a window of their own that scrolls in  */
+    /* place: a one line move is a hardware scroll plus one new row.   */
+    my_view_win = newwin(viewlines, viewcols, 3, 2);
+    idlok(my_view_win, TRUE);
+    scrollok(my_view_win, TRUE);
 
     wborder(my_form_win, '|', '|', '-', '-', '+', '+', '+', '+');
-    int first_line = 0;
-    int first_col = 0;
-    wrefresh(my_form_win);
-    prefresh(my_pad_win, first_line, first_col, 3, 2, subwinlines,
-	     subwincols);
-
-
-    /* Loop through to get user requests */
-    ch = wgetch(my_form_win);
-
-    while (ch != KEY_F(3) && ch != KEY_BACKSPACE) {
-
+    damage(my_form_win, false);
+    wnoutrefresh(my_form_win);
+
+    /* top and bot are the first and last rows on screen */
+    top_line = 0;
+    top_sub = 0;
+    finder = &search;
+    wrapOn = true;
+    firstCol = 0;
+    if (tab != NULL) {
+	top_line = tab->top_line;
+	top_sub = tab->top_sub;
+	wrapOn = tab->wrap;
+	firstCol = tab->firstCol;
+    }
+    wrapDoc = NULL;
+    seeking = seek_up = false;
+    shown = 0;
+    match = seek_at = -1;
+    rows = fillView(my_view_win, doc, width, top_line, top_sub,
+		    bot_line, bot_sub);
+    paint(my_view_win);
+    doc.load();
+    total = doc.lineCount();
+    note = doc.status();
+    scrollBar(my_form_win, top_line, total, viewlines, note);
+    paint(my_form_win);
+
+    /* Loop through to get user requests. A tab shown again does not  */
+    /* wait the first time round, to put its notes back on the border */
+    wtimeout(my_form_win,
+	     doc.growing() ? SEARCHTICK : tab != NULL ? 0 : -1);
+    ch = readKey(my_form_win);
+
+    while (ch != KEY_F(3) && ch != KEY_BACKSPACE
+	   && (tab == NULL || (ch != '\t' && ch != KEY_BTAB))) {
+
+	jump = true;
+	if (ch != ERR)
+	    warn.clear();
 	switch (ch) {
 	case KEY_UP:
-	    if (first_line > 0)
-		first_line--;
+	    jump = false;
+	    if (stepRow(doc, top_line, top_sub, width, -1)) {
+		stepRow(doc, bot_line, bot_sub, width, -1);
+		wscrl(my_view_win, -1);
+		docRow(doc, top_line, top_sub, width, cells);
+		mvwaddchnstr(my_view_win, 0, 0, &cells[0], cells.size());
+		scrollBar(my_form_win, top_line, total, viewlines, note);
+		paint(my_view_win);
+	    }
 	    break;
 	case KEY_DOWN:
-	    if (first_line <= (lines - (winlines - 4)))
-		first_line++;
+	    jump = false;
+	    if (rows == viewlines
+		&& stepRow(doc, bot_line, bot_sub, width, 1)) {
+		stepRow(doc, top_line, top_sub, width, 1);
+		wscrl(my_view_win, 1);
+		docRow(doc, bot_line, bot_sub, width, cells);
+		mvwaddchnstr(my_view_win, viewlines - 1, 0, &cells[0],
+			     cells.size());
+		scrollBar(my_form_win, top_line, total, viewlines, note);
+		paint(my_view_win);
+	    }
+	    break;
+	case KEY_NPAGE:
+	    for (i = 0; i < viewlines && rows == viewlines
+		 && stepRow(doc, bot_line, bot_sub, width, 1); i++)
+		stepRow(doc, top_line, top_sub, width, 1);
+	    break;
+	case KEY_PPAGE:
+	    for (i = 0; i < viewlines
+		 && stepRow(doc, top_line, top_sub, width, -1); i++);
+	    break;
+	case KEY_HOME:
+	    top_line = 0;
+	    top_sub = 0;
+	    break;
+	case KEY_END:
+	    /* the last line is not known until the index is done */
+	    doc.waitLoaded();
+	    total = doc.lineCount();
+	    lastPage(doc, width, viewlines, total, top_line, top_sub);
+	    break;
+	case KEY_LEFT:
+	case KEY_RIGHT:
+	    col = firstCol + (ch == KEY_RIGHT ? width / 2 : -width / 2);
+	    /* no further than half a window past the widest line shown */
+	    if (ch == KEY_RIGHT && !wrapOn) {
+		i = widestLine(doc, top_line, bot_line) - width / 2;
+		if (col > i)
+		    col = i > firstCol ? i : firstCol;
+	    }
+	    jump = !wrapOn && col >= 0 && col != firstCol;
+	    if (jump)
+		firstCol = col;
+	    break;
+	case 'w':
+	    wrapOn = !wrapOn;
+	    firstCol = 0;
+	    top_sub = 0;
+	    break;
+	case KEY_RESIZE:
+	    /* the windows take the new size; wrapped rows are laid out */
+	    /* again at the new width as they come into view             */
+	    if (LINES < 10 || COLS < 10)
+		break;
+	    winlines = LINES - 4;
+	    wincols = COLS - 2;
+	    viewlines = LINES - 9;
+	    viewcols = COLS - 6;
+	    width = wincols - 5;
+	    wresize(my_form_win, winlines, wincols);
+	    wresize(my_view_win, viewlines, viewcols);
+	    werase(my_form_win);
+	    wborder(my_form_win, '|', '|', '-', '-', '+', '+', '+', '+');
+	    top_sub = 0;
+	    break;
+	case 'g':
+	    answer = promptLine(my_form_win, " Line: ");
+	    n = atol(answer.c_str());
+	    /* index as far as the line, to clamp to the true end */
+	    if (n > 0 && !doc.hasLine(n - 1))
+		doc.waitLoaded();
+	    total = doc.lineCount();
+	    if (n > 0 && total > 0) {
+		top_line = n <= total ? n - 1 : total - 1;
+		top_sub = 0;
+	    }
+	    break;
+	case 't':
+	    answer = promptLine(my_form_win, " Time: ");
+	    if (total > 0
+		&& parseTime(answer.c_str(), answer.size(), when)) {
+		doc.waitLoaded();
+		total = doc.lineCount();
+		n = doc.findTime(when);
+		top_line = n < total ? n : total - 1;
+		top_sub = 0;
+	    }
 	    break;
+	case '/':
+	case '?':
+	    answer = promptLine(my_form_win, ch == '/' ? " /" : " ?");
+	    if (!answer.empty()) {
+		search.start(answer, doc.lineStart(top_line), ch == '?');
+		seeking = true;
+		seek_up = ch == '?';
+		seek_at = doc.lineStart(top_line);
+		match = -1;
+	    }
 	    break;
+	case '&':
+	case 'x':
+	    if (ch == '&') {
+		answer = promptLine(my_form_win, " &");
+		if (answer.empty())
+		    break;
+	    }
+	    {
+		FilterDocument filter(doc);
+		HexDocument hex(doc, HexDocument::rowBytes(width));
+		if (ch == '&' && !filter.start(answer)) {
+		    warn = " &" + answer + ": bad expression ";
+		    break;
+		}
+		wrap = wrapOn;
+		col = firstCol;
+		ch = view(ch == '&' ? (Document &) filter : hex);
+		wrapOn = wrap;
+		firstCol = col;
+	    }
+	    /* back from the filter: its windows covered this one */
+	    finder = &search;
+	    wborder(my_form_win, '|', '|', '-', '-', '+', '+', '+', '+');
+	    touchwin(my_form_win);
+	    touchwin(my_view_win);
+	    if (ch == KEY_F(3))
+		continue;
+	    break;
+	case 'n':
+	case 'N':
+	    jump = false;
+	    if (search.pattern().empty())
+		break;
+	    seeking = true;
+	    seek_up = search.backward() != (ch == 'N');
+	    if (match < 0)
+		seek_at = doc.lineStart(top_line);
+	    else
+		seek_at = seek_up ? match : match + 1;
+	    break;
+	default:
+	    jump = false;
+	    break;
+	}
+
+	/* go to the match looked for once the search has got that far, */
+	/* and show the matches found since the last time round          */
+	if (seeking && (n = search.next(seek_at, seek_up, match)) >= 0) {
+	    seeking = false;
+	    if (n == 1) {
+		top_line = doc.lineOf(match);
+		top_sub = 0;
+	    } else
+		match = -1;
+	    jump = true;
+	}
+
+	/* a followed file: rows appended while its end is on screen are */
+	/* added at the bottom; a new file is shown from the top         */
+	border = false;
+	if (doc.growing()) {
+	    at_end = rows < viewlines || (bot_line == total - 1
+		&& !docRow(doc, bot_line, bot_sub + 1, width, cells));
+	    change = doc.update();
+	    doc.load();
+	    switch (change) {
+	    case FOLLOWNEW:
+		search.reload(doc, false);
+		forgetRows(doc, 0);
+		top_line = 0;
+		top_sub = 0;
+		match = -1;
+		total = doc.lineCount();
+		jump = true;
+		break;
+	    case FOLLOWGREW:
+		search.reload(doc, true);
+		forgetRows(doc, total - 1);
+		total = doc.lineCount();
+		border = true;
+		if (jump || !at_end)
+		    break;
+		rows = appendRows(my_view_win, doc, width, rows, top_line,
+				  top_sub, bot_line, bot_sub);
+		if (rows < 0)
+		    lastPage(doc, width, viewlines, total, top_line,
+			     top_sub);
+		jump = rows < 0;
+		if (!jump) {
+		    scrollBar(my_form_win, top_line, total, viewlines, note);
+		    paint(my_view_win);
+		}
+		break;
+	    }
+	}
+
+	if (search.found() != shown) {
+	    shown = search.found();
+	    jump = true;
+	}
 
+	/* a document still growing fills any rows left empty */
+	if ((n = doc.lineCount()) != total) {
+	    total = n;
+	    border = true;
+	    if (rows < viewlines)
+		jump = true;
+	}
+	answer = warn + doc.status();
+	if (!wrapOn && firstCol > 0) {
+	    snprintf(progress, sizeof(progress), " col %d ", firstCol + 1);
+	    answer += progress;
 	}
-	prefresh(my_pad_win, first_line, first_col, 3, 2, subwinlines,
-		 subwincols);
-	wrefresh(my_form_win);
-	ch = wgetch(my_form_win);
+	if (!search.pattern().empty()) {
+	    if (search.running())
+		snprintf(progress, sizeof(progress), "%d%%",
+			 search.progress());
+	    else if (shown == 0)
+		snprintf(progress, sizeof(progress), "not found");
+	    else
+		snprintf(progress, sizeof(progress), "%lu match%s%s", shown,
+			 shown == 1 ? "" : "es",
+			 shown >= MAXMATCHES ? "+" : "");
+	    answer += string(" ") + (search.backward() ? "?" : "/") +
+		search.pattern() + ": " + progress + " ";
+	}
+	if (answer != note) {
+	    note = answer;
+	    border = true;
+	}
+	wtimeout(my_form_win, search.running() || seeking || doc.growing()
+		 ? SEARCHTICK : -1);
+
+	/* a jump redraws the window from the new top row */
+	if (jump) {
+	    rows = fillView(my_view_win, doc, width, top_line, top_sub,
+			    bot_line, bot_sub);
+	    scrollBar(my_form_win, top_line, total, viewlines, note);
+	    paint(my_view_win);
+	} else if (border) {
+	    scrollBar(my_form_win, top_line, total, viewlines, note);
+	    paint(my_form_win);
+	}
+	keyPainted("view");
+	ch = readKey(my_form_win);
     }
 
 
-    refresh();
-    wclear(my_form_win);
-    wrefresh(my_form_win);
+    finder = NULL;
+    if (tab != NULL) {
+	tab->top_line = top_line;
+	tab->top_sub = top_sub;
+	tab->wrap = wrapOn;
+	tab->firstCol = firstCol;
+    } else
+	forgetRows(doc, 0);
+    wrapOn = true;
+    firstCol = 0;
+    wrapDoc = NULL;
+    delwin(my_view_win);
+    /* the next tab paints over this one: only cells that differ go */
+    if (tab == NULL || (ch != '\t' && ch != KEY_BTAB)) {
+	paint(stdscr);
+	wclear(my_form_win);
+	paint(my_form_win);
+	keyPainted("view");
+    }
+    forget(my_form_win);
+    delwin(my_form_win);
 
     return ch;
 }
 
-
-
 /***********************************************************************/
-/* Routine: viewN(data,lines)                                          */
-/* Purpose: To show a window with data and wait for a message in a     */
-/*          message queue.                                             */
+/* Routine: promptLine(win,label)                                      */
+/* Purpose: To read a line of text typed on the bottom border of a     */
+/*          window. Enter takes it, Escape gives an empty one.         */
 /***********************************************************************/
 
-int CursesGui::viewN(string data, int lines)
+string CursesGui::promptLine(WINDOW * win, const char *label)
 {
-    int ch;
-    WINDOW *my_form_win, *my_pad_win;
-    string line;
-
-
-
-    keypad(stdscr, TRUE);
-
-
-    int winlines = LINES - 4;
-    int wincols = COLS - 2;
-    int subwincols = COLS - 5;
-    int subwinlines = LINES - 7;
-
-    my_pad_win = newpad(lines * 3, wincols - 5);
-    my_form_win = newwin(winlines, wincols, 2, 1);
-    keypad(my_form_win, TRUE);
-
-    int index, cnt;
-    unsigned int x;
-    string mysubstr;
-    index = 0;
-    x = 0;
-    cnt = 0;
-
-    while (x < data.size()) {
-	x = data.find("\n", index);
-	mysubstr = data.substr(index, (x - index));
-	index = x;
-	index++;
-	mvwprintw(my_pad_win, cnt, 0, " %s", mysubstr.c_str());
-	int sum = strlen(mysubstr.c_str()) / wincols + 1;
-	cnt = cnt + sum;
-	mysubstr.clear();
+    string text;
+    int ch, maxy, maxx, len;
+
+    getmaxyx(win, maxy, maxx);
+    len = strlen(label);
+    for (;;) {
+	mvwhline(win, maxy - 1, 1, '-', maxx - 2);
+	mvwaddnstr(win, maxy - 1, 2, label, maxx - 4);
+	if (len < maxx - 4)
+	    mvwaddnstr(win, maxy - 1, 2 + len, text.c_str(),
+		       maxx - 4 - len);
+	paint(win);
+	keyPainted("view");
+	ch = readKey(win);
+	if (ch == '\n' || ch == KEY_ENTER)
+	    return text;
+	if (ch == 27)
+	    return "";
+	if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+	    if (!text.empty())
+		text.erase(text.size() - 1);
+	} else if (ch >= ' ' && ch < 127)
+	    text += (char) ch;
     }
+}
 
-    wborder(my_form_win, '|', '|', '-', '-', '+', '+', '+', '+');
-    wCenterTitle(my_form_win, "CTRL-C to Exit");
-    int first_line = 0;
-    int first_col = 0;
-    wrefresh(my_form_win);
-    prefresh(my_pad_win, first_line, first_col, 3, 2, subwinlines,
-	     subwincols);
+/***********************************************************************/
+/* Routine: scrollBar(win,top,total,rows)                              */
+/* Purpose: To show where the top line is in a document of total lines */
+/*          as a thumb on the right border of the window around it,    */
+/*          and as top/total on its bottom border, with a note such as */
+/*          the search state on its left. The window is staged, not   */
+/*          sent.                                                      */
+/***********************************************************************/
 
-    // Wait for CTRL-C
-    ch = msgGet();
-    wclear(my_form_win);
-    wrefresh(my_form_win);
-    refresh();
-    return ch;
+void CursesGui::scrollBar(WINDOW * win, long top, long total, int rows,
+			  const string & note)
+{
+    char status[48];
+    int r, maxy, maxx, thumb, at, len;
+
+    getmaxyx(win, maxy, maxx);
+    thumb = rows;
+    at = 0;
+    if (total > rows) {
+	thumb = (int) ((double) rows * rows / total);
+	if (thumb < 1)
+	    thumb = 1;
+	at = (int) ((double) (rows - thumb) * top / (total - rows));
+	if (at > rows - thumb)
+	    at = rows - thumb;
+    }
+    for (r = 0; r < rows && r < maxy - 2; r++)
+	mvwaddch(win, r + 1, maxx - 1, r >= at && r < at + thumb ? '#' : '|');
+
+    len = snprintf(status, sizeof(status), " %ld/%ld ",
+		   total > 0 ? top + 1 : 0, total);
+    mvwhline(win, maxy - 1, 1, '-', maxx - 2);
+    if (len < maxx - 2)
+	mvwaddnstr(win, maxy - 1, maxx - 2 - len, status, len);
+    if (!note.empty() && maxx - 4 - len > 2)
+	mvwaddnstr(win, maxy - 1, 2, note.c_str(), maxx - 4 - len - 1);
+    damage(win, false);
+    wnoutrefresh(win);
 }
 
 /***********************************************************************/
-/* Routine: countLines(fname)                                          */
-/* Purpose: To count the lines in a filename.                          */
-/*                                                                     */
+/* Routine: fillView(win,doc,width,top_line,top_sub,bot_line,bot_sub) */
+/* Purpose: To draw a window full of a document from the given row     */
+/*          down, leaving the position of the last row drawn in        */
+/*          bot_line/bot_sub. Returns the number of rows drawn.        */
 /***********************************************************************/
 
-int CursesGui::countLines(string filename)
+int CursesGui::fillView(WINDOW * win, Document & doc, int width,
+			long top_line, int top_sub, long &bot_line,
+			int &bot_sub)
 {
+    int rows, sub;
+    long line;
+    vector < chtype > cells;
 
+    werase(win);
+    rows = 0;
+    line = bot_line = top_line;
+    sub = bot_sub = top_sub;
+    if (!docRow(doc, line, sub, width, cells))
+	return 0;
+    while (rows < getmaxy(win)) {
+	mvwaddchnstr(win, rows++, 0, &cells[0], cells.size());
+	bot_line = line;
+	bot_sub = sub;
+	if (!stepRow(doc, line, sub, width, 1))
+	    break;
+	docRow(doc, line, sub, width, cells);
+    }
+    doc.hasLine(bot_line + rows);
+    return rows;
+}
 
-    ifstream myfile;
-    string line;
-    int cnt=0;
+/***********************************************************************/
+/* Routine: docRow(doc,line,sub,width,cells)                           */
+/* Purpose: The cells of row sub of a line wrapped at width, false if  */
+/*          there is no such row. Every line starts one cell in. With  */
+/*          wrapping off a line is one row, from column firstCol on.   */
+/***********************************************************************/
 
-    myfile.open(filename.c_str());
+bool CursesGui::docRow(Document & doc, long line, int sub, int width,
+			vector < chtype > &cells)
+{
+    const RowCells *row;
+    const char *text;
+    size_t len, off, end;
+    vector < char >hl;
+    vector < chtype > marked;
+    const vector < chtype > *from;
+
+    if (sub < 0 || (sub > 0 && !wrapOn))
+	return false;
+    off = wrapOn ? (size_t) sub * width : 1 + firstCol;
+    row = lineCells(doc, line, off, width);
+    if (row == NULL || (sub > 0 && off >= row->width))
+	return false;
+    from = &row->cells;
+    if (finder != NULL && row->len > 0 && finder->found() > 0) {
+	doc.highlight(line, row->len, *finder, hl);
+	if (memchr(&hl[row->at], 1, row->end - row->at) != NULL) {
+	    /* matches are marked on a copy; the cached line stays plain */
+	    text = doc.line(line, len);
+	    if (row->from == 0)
+		marked.push_back(' ' | row->attr);
+	    textCells(text, len, row->at, row->end,
+		      row->from > 0 ? row->from : 1, row->attr, marked,
+		      &hl[0]);
+	    from = &marked;
+	}
+    }
+    cells.clear();
+    if (!wrapOn) {
+	/* the margin stays; the columns scrolled off go */
+	cells.push_back(' ' | row->attr);
+	width--;
+	if (off > row->width)
+	    off = row->width;
+    }
+    end = row->from + from->size();
+    if (off + width < end)
+	end = off + width;
+    cells.insert(cells.end(), from->begin() + (off - row->from),
+		 from->begin() + (end - row->from));
+    return true;
+}
+
+/***********************************************************************/
+/* Routine: stepRow(doc,line,sub,width,dir)                            */
+/* Purpose: To move a row position one row down (dir 1) or up (-1),    */
+/*          across wrapped rows. It is left alone, and false returned, */
+/*          at either end of the document.                             */
+/***********************************************************************/
 
-    if (myfile.is_open()) {
-	cnt = 0;
-	while (!myfile.eof()) {
-	    getline(myfile, line);
-	    cnt++;
-	}			/* End while */
+bool CursesGui::stepRow(Document & doc, long &line, int &sub, int width,
+			int dir)
+{
+    if (dir > 0) {
+	if (sub + 1 < lineRows(doc, line, width)) {
+	    sub++;
+	    return true;
+	}
+	if (!doc.hasLine(line + 1))
+	    return false;
+	line++;
+	sub = 0;
+	return true;
+    }
+    if (sub > 0) {
+	sub--;
+	return true;
     }
-    myfile.close();
-    return cnt;
+    if (line == 0)
+	return false;
+    line--;
+    sub = lineRows(doc, line, width) - 1;
+    return true;
+}
 
+/***********************************************************************/
+/* Routine: lineRows(doc,line,width)                                   */
+/* Purpose: The rows a line wraps to at width. Lines are measured for */
+/*          this only as they are met, and the answer kept until the   */
+/*          width changes, so moving up through long lines or paging   */
+/*          back does not measure each one again.                      */
+/***********************************************************************/
+
+int CursesGui::lineRows(Document & doc, long line, int width)
+{
+    map < long, int >::iterator it;
+    long cols;
+    int rows;
+
+    if (!wrapOn)
+	return 1;
+    if (&doc != wrapDoc || width != wrapWidth
+	|| wrapRows.size() >= WRAPCACHE) {
+	wrapRows.clear();
+	wrapDoc = &doc;
+	wrapWidth = width;
+    }
+    it = wrapRows.find(line);
+    if (it != wrapRows.end())
+	return it->second;
+    cols = lineWidth(doc, line);
+    if (cols < 0)
+	return 1;
+    rows = (cols + width - 1) / width;
+    wrapRows[line] = rows;
+    return rows;
 }
 
 /***********************************************************************/
-/*  Routine: countChars(string)                                        */
-/*  Purpose: To find the number of end of lines in a string there are  */
-/*                                                                     */
+/* Routine: lineWidth(doc,line)                                        */
+/* Purpose: The cells a line takes, margin included, -1 past the end.  */
+/*          A line not laid out already is measured as textCells would */
+/*          lay it out, but no cells are made for it.                  */
+/***********************************************************************/
+
+long CursesGui::lineWidth(Document & doc, long line)
+{
+    map < pair < Document *, long >, list < RowCells >::iterator >::iterator
+	it;
+    const char *text;
+    size_t len, at, cols;
+
+    it = rowIndex.find(make_pair(&doc, line));
+    if (it != rowIndex.end())
+	return it->second->width;
+    text = doc.line(line, len);
+    if (text == NULL)
+	return -1;
+    at = 0;
+    cols = 1;
+    cellByte(text, len, (size_t) -1, at, cols);
+    return cols;
+}
+
+/***********************************************************************/
+/* Routine: widestLine(doc,top_line,bot_line)                          */
+/* Purpose: The columns taken by the widest of the lines on screen,    */
+/*          for scrolling across to stop at.                           */
+/***********************************************************************/
+
+int CursesGui::widestLine(Document & doc, long top_line, long bot_line)
+{
+    long n, cols, widest = 0;
+
+    for (n = top_line; n <= bot_line; n++) {
+	cols = lineWidth(doc, n);
+	if (cols < 0)
+	    break;
+	if (cols - 1 > widest)
+	    widest = cols - 1;
+    }
+    return widest < INT_MAX ? widest : INT_MAX;
+}
+
+/***********************************************************************/
+/* Routine: forgetRows(doc,from)                                   */
+/* Purpose: To drop what lineRows and lineCells know of the lines of   */
+/*          doc from 'from' on, as their text has changed or the       */
+/*          document is going.                                         */
+/***********************************************************************/
+
+void CursesGui::forgetRows(Document & doc, long from)
+{
+    map < pair < Document *, long >, list < RowCells >::iterator >::iterator
+	it;
+
+    if (&doc == wrapDoc)
+	wrapRows.erase(wrapRows.lower_bound(from), wrapRows.end());
+    it = rowIndex.lower_bound(make_pair(&doc, from));
+    while (it != rowIndex.end() && it->first.first == &doc) {
+	rowCells -= it->second->cells.size();
+	rowLru.erase(it->second);
+	rowIndex.erase(it++);
+    }
+}
+
+/***********************************************************************/
+/* Routine: lineCells(doc,line,col,span)                               */
+/* Purpose: A line laid out in cells, margin first, as docRow slices   */
+/*          it into rows, or of a line wider than ROWSLICE cells the   */
+/*          slice of it holding the span cells from col on: a quarter  */
+/*          of it before col, for moving back, the rest after. The     */
+/*          lines shown last are kept, up to rowLimit cells, so paging */
+/*          back over them or moving across them only copies cells;    */
+/*          those seen least recently go first. The cells do not       */
+/*          depend on the width, so one line serves every width and    */
+/*          column scrolled to. NULL past the end.                     */
+/***********************************************************************/
+
+const RowCells *CursesGui::lineCells(Document & doc, long line,
+				     size_t col, int span)
+{
+    map < pair < Document *, long >, list < RowCells >::iterator >::iterator
+	it;
+    RowCells *row;
+    const char *text;
+    size_t len, at, from, end, to, cols;
+    chtype attr;
+
+    attr = cellAttr(stdscr);
+    at = 0;
+    from = 1;
+    cols = 0;
+    it = rowIndex.find(make_pair(&doc, line));
+    if (it != rowIndex.end()) {
+	row = &*it->second;
+	if (col > row->width)
+	    col = row->width;
+	if (row->attr == attr && col >= row->from
+	    && (col + span <= row->from + row->cells.size()
+		|| row->end == row->len)) {
+	    rowHits++;
+	    rowLru.splice(rowLru.begin(), rowLru, it->second);
+	    return &rowLru.front();
+	}
+	/* another slice of the line is looked for from this one on */
+	cols = row->width;
+	if (row->from > 0 && row->from + ROWSLICE / 4 <= col) {
+	    at = row->at;
+	    from = row->from;
+	}
+	rowCells -= row->cells.size();
+	rowLru.erase(it->second);
+	rowIndex.erase(it);
+    }
+    text = doc.line(line, len);
+    if (text == NULL)
+	return NULL;
+    if (cols == 0) {
+	end = 0;
+	cols = 1;
+	cellByte(text, len, (size_t) -1, end, cols);
+    }
+    if (col > cols)
+	col = cols;
+    if (cols <= ROWSLICE || col <= ROWSLICE / 4) {
+	at = 0;
+	from = 0;
+    } else
+	cellByte(text, len, col - ROWSLICE / 4, at, from);
+    end = at;
+    to = from > 0 ? from : 1;
+    cellByte(text, len, from + ROWSLICE, end, to);
+
+    rowMisses++;
+    rowLru.push_front(RowCells());
+    row = &rowLru.front();
+    row->doc = &doc;
+    row->line = line;
+    row->len = len;
+    row->width = cols;
+    row->from = from;
+    row->at = at;
+    row->end = end;
+    row->attr = attr;
+    if (from == 0)
+	row->cells.push_back(' ' | attr);
+    textCells(text, len, at, end, from > 0 ? from : 1, attr, row->cells);
+    rowCells += row->cells.size();
+    rowIndex[make_pair(&doc, line)] = rowLru.begin();
+    trimRows();
+    return row;
+}
+
+/***********************************************************************/
+/* Routine: trimRows()                                                 */
+/* Purpose: To drop the lines seen least recently until those kept fit */
+/*          in rowLimit cells. The line laid out last stays, though it */
+/*          may be over them by up to a slice.                         */
+/***********************************************************************/
+
+void CursesGui::trimRows(void)
+{
+    while (rowCells > rowLimit && rowLru.size() > 1) {
+	rowCells -= rowLru.back().cells.size();
+	rowIndex.erase(make_pair(rowLru.back().doc, rowLru.back().line));
+	rowLru.pop_back();
+    }
+}
+
+
+
+/***********************************************************************/
+/* Routine: lastPage(doc,width,rows,total,top_line,top_sub)            */
+/* Purpose: The top row that puts the document's last row at the      */
+/*          bottom of a window of the given rows, unless it all fits.  */
+/***********************************************************************/
+
+void CursesGui::lastPage(Document & doc, int width, int rows, long total,
+			 long &top_line, int &top_sub)
+{
+    int i;
+
+    if (total == 0)
+	return;
+    top_line = total - 1;
+    top_sub = lineRows(doc, top_line, width) - 1;
+    for (i = 1; i < rows && stepRow(doc, top_line, top_sub, width, -1);
+	 i++);
+}
+
+/***********************************************************************/
+/* Routine: appendRows(win,doc,width,rows,top..,bot..)                 */
+/* Purpose: To add the rows of text appended to a document below the   */
+/*          last row of a window showing its end, scrolling it up once */
+/*          full. The last row is drawn again, as its line may have    */
+/*          been unfinished. Returns the rows now in the window, or -1 */
+/*          if more than a window full came and it must be redrawn.    */
+/***********************************************************************/
+
+int CursesGui::appendRows(WINDOW * win, Document & doc, int width, int rows,
+			  long &top_line, int &top_sub, long &bot_line,
+			  int &bot_sub)
+{
+    vector < chtype > cells;
+    int n, viewlines = getmaxy(win);
+
+    if (rows == 0)
+	return -1;
+    if (docRow(doc, bot_line, bot_sub, width, cells)) {
+	wmove(win, rows - 1, 0);
+	wclrtoeol(win);
+	mvwaddchnstr(win, rows - 1, 0, &cells[0], cells.size());
+    }
+    for (n = 0; stepRow(doc, bot_line, bot_sub, width, 1); n++) {
+	if (n == viewlines)
+	    return -1;
+	docRow(doc, bot_line, bot_sub, width, cells);
+	if (rows < viewlines)
+	    rows++;
+	else {
+	    stepRow(doc, top_line, top_sub, width, 1);
+	    wscrl(win, 1);
+	}
+	mvwaddchnstr(win, rows - 1, 0, &cells[0], cells.size());
+    }
+    return rows;
+}
+
+/***********************************************************************/
+/* Routine: viewN(doc)                                                 */
+/* Purpose: To show a window with a document and wait for a message in */
+/*          a message queue.                                           */
+/***********************************************************************/
+
+int CursesGui::viewN(Document & doc)
+{
+    int ch, bot_sub;
+    long bot_line;
+    WINDOW *my_form_win, *my_view_win;
+
+    keypad(stdscr, TRUE);
+
+    int winlines = LINES - 4;
+    int wincols = COLS - 2;
+    int viewlines = LINES - 9;
+    int viewcols = COLS - 6;
+
+    my_form_win = newwin(winlines, wincols, 2, 1);
+    keypad(my_form_win, TRUE);
+    my_view_win = newwin(viewlines, viewcols, 3, 2);
+
+    wborder(my_form_win, '|', '|', '-', '-', '+', '+', '+', '+');
+    wCenterTitle(my_form_win, "CTRL-C to Exit");
+    damage(my_form_win, false);
+    wnoutrefresh(my_form_win);
+    fillView(my_view_win, doc, wincols - 5, 0, 0, bot_line, bot_sub);
+    damage(my_view_win, false);
+    wnoutrefresh(my_view_win);
+    sendFrame(true);
+
+    // Wait for CTRL-C
+    ch = msgGet();
+    delwin(my_view_win);
+    wclear(my_form_win);
+    paint(my_form_win);
+    forget(my_form_win);
+    delwin(my_form_win);
+    paint(stdscr);
+    return ch;
+}
+
+
+/***********************************************************************/
+/* Routine: utf8Locale()                                               */
+/* Purpose: Whether text is taken for UTF-8: the program's locale says */
+/*          so, or the user's does when the program has set none.      */
+/***********************************************************************/
+
+static bool utf8Locale(void)
+{
+    static int utf8 = -1;
+    const char *name;
+    locale_t user;
+
+    if (utf8 < 0) {
+	name = setlocale(LC_CTYPE, NULL);
+	if (name != NULL && strcmp(name, "C") != 0
+	    && strcmp(name, "POSIX") != 0)
+	    utf8 = strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
+	else {
+	    user = newlocale(LC_CTYPE_MASK, "", (locale_t) 0);
+	    utf8 = user != (locale_t) 0
+		&& strcmp(nl_langinfo_l(CODESET, user), "UTF-8") == 0;
+	    if (user != (locale_t) 0)
+		freelocale(user);
+	}
+    }
+    return utf8;
+}
+
+/***********************************************************************/
+/* Routine: utf8Byte(text,len,i)                                       */
+/* Purpose: Whether byte i, one of 0x80 to 0x9f, continues a valid     */
+/*          UTF-8 character: not overlong, not a surrogate, and not    */
+/*          past U+10FFFF.                                             */
 /***********************************************************************/
 
-int CursesGui::countChars(string mychar)
+static bool utf8Byte(const char *text, long len, long i)
 {
-    unsigned int cnt, x, index;
+    const unsigned char *t = (const unsigned char *) text;
+    unsigned char lo, hi;
+    long lead, need, k;
+
+    for (lead = i - 1; lead >= 0 && lead > i - 4 && (t[lead] & 0xc0) == 0x80;
+	 lead--);
+    if (lead < 0 || lead == i - 4)
+	return false;
+    lo = 0x80;
+    hi = 0xbf;
+    if (t[lead] >= 0xc2 && t[lead] <= 0xdf)
+	need = 1;
+    else if (t[lead] >= 0xe0 && t[lead] <= 0xef) {
+	need = 2;
+	if (t[lead] == 0xe0)
+	    lo = 0xa0;
+	else if (t[lead] == 0xed)
+	    hi = 0x9f;
+    } else if (t[lead] >= 0xf0 && t[lead] <= 0xf4) {
+	need = 3;
+	if (t[lead] == 0xf0)
+	    lo = 0x90;
+	else if (t[lead] == 0xf4)
+	    hi = 0x8f;
+    } else
+	return false;
+    if (i - lead > need || lead + need >= len)
+	return false;
+    if (t[lead + 1] < lo || t[lead + 1] > hi)
+	return false;
+    for (k = 2; k <= need; k++)
+	if ((t[lead + k] & 0xc0) != 0x80)
+	    return false;
+    return true;
+}
+
+/***********************************************************************/
+/* Routine: textCells(text,len,at,end,col,attr,cells,hl)               */
+/* Purpose: To append bytes at to end of a line of text to a row of    */
+/*          cells the way waddch would show them, the first at cell    */
+/*          col of the row: tabs expand to the next multiple of 8 and  */
+/*          other control characters show as ^X. C1 controls, 0x80 to  */
+/*          0x9f, show as M-^X as cat -v has them, unless they are     */
+/*          part of a UTF-8 character and text is taken for UTF-8: a   */
+/*          terminal could take 0x9b for the start of a sequence.      */
+/*          Bytes flagged in hl are shown in reverse. Runs of bytes    */
+/*          that need none of this are found by plainBytes and copied  */
+/*          in bulk.                                                   */
+/***********************************************************************/
 
-    cnt = 0;
-    index = 0;
-    x = 0;
-    while (x < mychar.size()) {
-	x = mychar.find("\n", index);
-	index = x;
-	cnt++;
-	index++;
+void CursesGui::textCells(const char *text, size_t len, size_t at,
+			  size_t end, size_t col, chtype attr,
+			  vector < chtype > &cells, const char *hl)
+{
+    size_t i, n, run, lead;
+    unsigned char c;
+    chtype base = attr;
+
+    lead = col - cells.size();
+    for (i = at; i < end; i++) {
+	run = plainBytes(text + i, end - i);
+	if (run > 0) {
+	    n = cells.size();
+	    cells.resize(n + run);
+	    if (hl == NULL)
+		for (; run > 0; run--)
+		    cells[n++] = (unsigned char) text[i++] | base;
+	    else
+		for (; run > 0; run--, i++)
+		    cells[n++] = (unsigned char) text[i] |
+			(hl[i] ? base | A_REVERSE : base);
+	    if (i == end)
+		break;
+	}
+	c = text[i];
+	attr = hl != NULL && hl[i] ? base | A_REVERSE : base;
+	if (c == '\t') {
+	    do
+		cells.push_back(' ' | attr);
+	    while ((lead + cells.size()) % 8 != 0);
+	} else if (c < ' ' || c == 127) {
+	    if (c == '\r' && i == len - 1)
+		break;
+	    cells.push_back('^' | attr);
+	    cells.push_back((c ^ 0x40) | attr);
+	} else if (c < 0xa0 && !(utf8Locale() && utf8Byte(text, len, i))) {
+	    cells.push_back('M' | attr);
+	    cells.push_back('-' | attr);
+	    cells.push_back('^' | attr);
+	    cells.push_back((c ^ 0xc0) | attr);
+	} else
+	    cells.push_back(c | attr);
     }
-    return cnt;
 }
 
+/***********************************************************************/
+/* Routine: cellByte(text,len,col,at,from)                             */
+/* Purpose: To measure a line as textCells lays it out, without laying */
+/*          it out: from byte at, which starts at cell from, on to the */
+/*          byte whose cells take in cell col. at and from are left at */
+/*          that byte and the cell it starts at, or at len and the     */
+/*          cells of the whole line if col is past its end.            */
+/***********************************************************************/
+
+void CursesGui::cellByte(const char *text, size_t len, size_t col,
+			 size_t &at, size_t &from)
+{
+    size_t run, cells;
+    unsigned char c;
+
+    while (at < len && from <= col) {
+	run = len - at;
+	if (col - from < run)
+	    run = col - from;
+	run = plainBytes(text + at, run);
+	at += run;
+	from += run;
+	if (at == len || from == col)
+	    break;
+	c = text[at];
+	if (c == '\t')
+	    cells = 8 - from % 8;
+	else if (c < ' ' || c == 127)
+	    cells = c == '\r' && at == len - 1 ? 0 : 2;
+	else if (c < 0xa0 && !(utf8Locale() && utf8Byte(text, len, at)))
+	    cells = 4;
+	else
+	    cells = 1;
+	if (from + cells > col)
+	    break;
+	at++;
+	from += cells;
+    }
+}
 
 /***********************************************************************/
 /* Routine: msgGet(void)                                               */
@@ -1158,6 +2580,816 @@ int CursesGui::msgGet()
 }
 
 
+/***********************************************************************/
+/* Routine: beginFrame() / endFrame()                                  */
+/* Purpose: To batch screen updates. Inside a frame the print helpers  */
+/*          only stage their changes (wnoutrefresh) and endFrame()     */
+/*          sends the whole frame to the terminal with one doupdate(). */
+/*          Frames may be nested; only the outermost endFrame flushes. */
+/*          Interactive widgets (menus, dialogs, viewers) still        */
+/*          refresh immediately, which also flushes anything staged.   */
+/***********************************************************************/
+
+void CursesGui::beginFrame(void)
+{
+    frameDepth++;
+}
+
+void CursesGui::endFrame(void)
+{
+    CallScope scope(this, "endFrame");
+    if (frameDepth == 0)
+	return;
+    if (--frameDepth == 0)
+	sendFrame(false);
+}
+
+
+/***********************************************************************/
+/* Routine: refreshWin(WINDOW,repaint)                                 */
+/* Purpose: To refresh a window, or only stage it for the next         */
+/*          doupdate() when a frame is open. repaint tells damage      */
+/*          tracking that the whole window was meant to be redrawn.    */
+/***********************************************************************/
+
+void CursesGui::refreshWin(WINDOW * win, bool repaint)
+{
+    damage(win, repaint);
+    wnoutrefresh(win);
+    if (frameDepth == 0)
+	sendFrame(false);
+}
+
+
+/***********************************************************************/
+/* Routine: paint(WINDOW)                                              */
+/* Purpose: To show a window now, as a frame of its own. Used by the   */
+/*          interactive widgets, which refresh even inside a frame     */
+/*          and whatever the bandwidth budget. The back buffer is kept */
+/*          up to date like refreshWin's, so a later refreshWin of the */
+/*          window compares with what is really on the screen.        */
+/***********************************************************************/
+
+void CursesGui::paint(WINDOW * win)
+{
+    damage(win, false);
+    wnoutrefresh(win);
+    sendFrame(true);
+}
+
+
+/***********************************************************************/
+/* Routine: pushKey(key) / pushKeys(string)                            */
+/* Purpose: To queue input for a headless screen. Function and cursor  */
+/*          keys are sent as the escape sequence the terminal binds    */
+/*          to them, so widgets decode them exactly like real input.   */
+/*          Keys wait in memory for room in the input pipe, so a       */
+/*          script of any length can be queued before calling a       */
+/*          widget; once it has run dry a read gives ERR after         */
+/*          HEADLESSWAIT ms instead of blocking.                       */
+/***********************************************************************/
+
+void CursesGui::pushKey(int key)
+{
+    char *seq;
+
+    if (keyPipe == -1)
+	return;
+    if (key < 256) {
+	keyLock.lock();
+	keyQueue += (char) key;
+	keyLock.unlock();
+    } else {
+	seq = keybound(key, 0);
+	if (seq == NULL)
+	    return;
+	keyLock.lock();
+	keyQueue += seq;
+	keyLock.unlock();
+	free(seq);
+    }
+    feedKeys();
+}
+
+/***********************************************************************/
+/* Routine: feedKeys()                                                 */
+/* Purpose: To move the keys queued into the input pipe, as many as it */
+/*          has room for. Its write end never blocks.                  */
+/***********************************************************************/
+
+void CursesGui::feedKeys(void)
+{
+    ssize_t n;
+    lock_guard < mutex > hold(keyLock);
+
+    while (!keyQueue.empty()) {
+	n = write(keyPipe, keyQueue.data(), keyQueue.size());
+	if (n <= 0) {
+	    if (n == -1 && errno != EAGAIN)
+		cerr << "Error: cannot queue key" << endl;
+	    return;
+	}
+	keyQueue.erase(0, n);
+    }
+}
+
+void CursesGui::pushKeys(string keys)
+{
+    unsigned int i;
+
+    for (i = 0; i < keys.size(); i++)
+	pushKey((unsigned char) keys[i]);
+}
+
+
+/***********************************************************************/
+/* Routine: getScreen() / getCell(y,x)                                 */
+/* Purpose: To read back what is on the screen: the text of every row, */
+/*          or one cell with its attributes and color pair.            */
+/***********************************************************************/
+
+vector < string > CursesGui::getScreen(void)
+{
+    vector < string > rows;
+    vector < chtype > cells(COLS + 1);
+    int y, x, cy, cx;
+
+    getyx(curscr, cy, cx);
+    for (y = 0; y < LINES; y++) {
+	string row(COLS, ' ');
+	mvwinchnstr(curscr, y, 0, &cells[0], COLS);
+	for (x = 0; x < COLS && cells[x] != 0; x++)
+	    row[x] = (char) (cells[x] & A_CHARTEXT);
+	rows.push_back(row);
+    }
+    wmove(curscr, cy, cx);
+    return rows;
+}
+
+chtype CursesGui::getCell(int y, int x)
+{
+    chtype cell;
+    int cy, cx;
+
+    getyx(curscr, cy, cx);
+    cell = mvwinch(curscr, y, x);
+    wmove(curscr, cy, cx);
+    return cell;
+}
+
+
+/***********************************************************************/
+/* Routine: setDamageTracking(bool)                                    */
+/* Purpose: To keep a back buffer of what every window last sent to    */
+/*          the screen. Widgets that repaint a whole window (werase,   */
+/*          box, touchwin) then only hand the cells that really        */
+/*          changed to ncurses. Windows painted directly with ncurses  */
+/*          calls outside CursesGui are not tracked.                   */
+/***********************************************************************/
+
+void CursesGui::setDamageTracking(bool on)
+{
+    damageTracking = on;
+    shadows.clear();
+}
+
+
+/***********************************************************************/
+/* Routine: damage(WINDOW,repaint)                                     */
+/* Purpose: To compare a window with its back buffer before it is      */
+/*          refreshed. In rows known to be on screen only the runs of  */
+/*          cells that differ are left marked for ncurses, and rows    */
+/*          whose hash did not change are skipped. Rows another window */
+/*          painted over keep the caller's marks, or are sent whole    */
+/*          when the caller meant to repaint the window (touchwin).    */
+/***********************************************************************/
+
+void CursesGui::damage(WINDOW * win, bool repaint)
+{
+    int y, x, x0, maxy, maxx, begy, begx, cy, cx;
+    unsigned long h;
+
+    if (!damageTracking || win == NULL || is_pad(win))
+	return;
+
+    getmaxyx(win, maxy, maxx);
+    getbegyx(win, begy, begx);
+    getyx(win, cy, cx);
+
+    CellShadow & sh = shadows[win];
+    if (sh.lines != maxy || sh.cols != maxx || sh.begy != begy
+	|| sh.begx != begx || sh.cells.empty()) {
+	sh.begy = begy;
+	sh.begx = begx;
+	sh.lines = maxy;
+	sh.cols = maxx;
+	sh.cells.assign(maxy * maxx, 0);
+	sh.hash.assign(maxy, 0);
+	sh.valid.assign(maxy, 0);
+    }
+
+    vector < chtype > row(maxx + 1);
+    for (y = 0; y < maxy; y++) {
+	chtype *old = &sh.cells[y * maxx];
+
+	mvwinchnstr(win, y, 0, &row[0], maxx);
+	h = 2166136261UL;	/* FNV-1a */
+	for (x = 0; x < maxx; x++)
+	    h = (h ^ row[x]) * 16777619UL;
+
+	if (sh.valid[y]) {
+	    wtouchln(win, y, 1, 0);
+	    if (sh.hash[y] == h
+		&& memcmp(old, &row[0], maxx * sizeof(chtype)) == 0)
+		continue;
+	    for (x = 0; x < maxx; x++) {
+		if (row[x] == old[x])
+		    continue;
+		for (x0 = x; x < maxx && row[x] != old[x]; x++);
+		mvwaddchnstr(win, y, x0, &row[x0], x - x0);
+		invalidate(begy + y, begx + x0, 1, x - x0, win);
+	    }
+	} else if (repaint) {
+	    wtouchln(win, y, 1, 1);
+	    invalidate(begy + y, begx, 1, maxx, win);
+	    sh.valid[y] = 1;
+	} else if (is_linetouched(win, y)) {
+	    invalidate(begy + y, begx, 1, maxx, win);
+	}
+	memcpy(old, &row[0], maxx * sizeof(chtype));
+	sh.hash[y] = h;
+    }
+    wmove(win, cy, cx);
+}
+
+
+/***********************************************************************/
+/* Routine: invalidate(y,x,lines,cols,WINDOW)                          */
+/* Purpose: To mark the back buffer rows of every window but one that  */
+/*          overlap a screen area which has just been painted.         */
+/***********************************************************************/
+
+void CursesGui::invalidate(int y, int x, int lines, int cols,
+			   WINDOW * except)
+{
+    map < WINDOW *, CellShadow >::iterator it;
+    int row;
+
+    for (it = shadows.begin(); it != shadows.end(); ++it) {
+	CellShadow & sh = it->second;
+	if (it->first == except || x >= sh.begx + sh.cols
+	    || x + cols <= sh.begx)
+	    continue;
+	for (row = y; row < y + lines; row++)
+	    if (row >= sh.begy && row < sh.begy + sh.lines)
+		sh.valid[row - sh.begy] = 0;
+    }
+}
+
+
+/***********************************************************************/
+/* Routine: forget(WINDOW)                                             */
+/* Purpose: To drop the back buffer of a window that is deleted,       */
+/*          moved or cleared, and invalidate what lies under it.       */
+/***********************************************************************/
+
+void CursesGui::forget(WINDOW * win)
+{
+    int begy, begx, maxy, maxx;
+
+    if (!damageTracking)
+	return;
+    getbegyx(win, begy, begx);
+    getmaxyx(win, maxy, maxx);
+    shadows.erase(win);
+    invalidate(begy, begx, maxy, maxx, NULL);
+}
+
+
+/***********************************************************************/
+/* Routine: setBandwidth(bytesPerSecond)                               */
+/* Purpose: To drive a terminal on a slow line. Every refresh becomes  */
+/*          a frame sent with doupdate() only while the line has       */
+/*          budget left; a frame that finds the budget spent is kept   */
+/*          staged, and the next one, or a widget waiting for a key    */
+/*          once the budget has refilled, sends the latest screen. An  */
+/*          application that waits for input of its own should call   */
+/*          flushFrame() first. Boxes and titles use plain ASCII so no */
+/*          alternate character set switches are sent. 0 restores      */
+/*          immediate, unlimited output.                               */
+/***********************************************************************/
+
+void CursesGui::setBandwidth(long bytesPerSecond)
+{
+    flushFrame();
+    bandwidth = bytesPerSecond > 0 ? bytesPerSecond : 0;
+    tokens = bandwidth;
+    gettimeofday(&lastFill, NULL);
+}
+
+/***********************************************************************/
+/* Routine: setColors(bool)                                            */
+/* Purpose: To turn colors off (or back on). Without colors the screen */
+/*          keeps the terminal's own colors and widgets only use bold, */
+/*          underline and reverse, which saves color escapes on every  */
+/*          attribute change.                                          */
+/***********************************************************************/
+
+void CursesGui::setColors(bool on)
+{
+    colorsOn = on;
+    if (!has_colors())
+	return;
+    if (on)
+	assume_default_colors(COLOR_WHITE, COLOR_BLUE);
+    else
+	assume_default_colors(-1, -1);
+}
+
+/***********************************************************************/
+/* Routine: flushFrame()                                               */
+/* Purpose: To send a frame held back by the bandwidth budget now.     */
+/***********************************************************************/
+
+void CursesGui::flushFrame(void)
+{
+    CallScope scope(this, "flushFrame");
+
+    if (pendingFrame)
+	sendFrame(true);
+}
+
+/***********************************************************************/
+/* Routine: bytesSent() / framesSkipped()                              */
+/* Purpose: Bytes written to the terminal by refreshes and frames, and */
+/*          frames held back because the line was over budget.         */
+/***********************************************************************/
+
+unsigned long CursesGui::bytesSent(void)
+{
+    account();
+    return sentBytes;
+}
+
+unsigned long CursesGui::framesSkipped(void)
+{
+    return skippedFrames;
+}
+
+/***********************************************************************/
+/* Routine: sendFrame(force)                                           */
+/* Purpose: To send what is staged with doupdate(), unless the         */
+/*          bandwidth budget is spent and the frame may be skipped.    */
+/*          With synchronized output the frame is bracketed so the     */
+/*          terminal shows it all at once.                             */
+/***********************************************************************/
+
+void CursesGui::sendFrame(bool force)
+{
+    struct timeval now;
+
+    if (bandwidth > 0 && !force) {
+	refill();
+	if (tokens <= 0) {
+	    pendingFrame = true;
+	    skippedFrames++;
+	    return;
+	}
+    }
+    if (callMethod != NULL)
+	gettimeofday(&now, NULL);
+    writeFrame();
+    if (callMethod != NULL)
+	callRefresh += elapsedSince(now);
+    pendingFrame = false;
+    if (bandwidth > 0)
+	account();
+}
+
+/***********************************************************************/
+/* Routine: refill() / heldFor()                                       */
+/* Purpose: To add the budget the line has earned since the last fill, */
+/*          less what was sent meanwhile, and to tell how many ms a    */
+/*          frame held back has to wait for it: -1 if none is held.    */
+/***********************************************************************/
+
+void CursesGui::refill(void)
+{
+    account();
+    tokens += elapsedSince(lastFill) * bandwidth;
+    gettimeofday(&lastFill, NULL);
+    if (tokens > bandwidth)
+	tokens = bandwidth;
+}
+
+int CursesGui::heldFor(void)
+{
+    if (!pendingFrame || bandwidth <= 0)
+	return -1;
+    refill();
+    if (tokens > 0)
+	return 0;
+    return (int) ceil(-tokens * 1000 / bandwidth) + 1;
+}
+
+/***********************************************************************/
+/* Routine: account()                                                  */
+/* Purpose: To add what went to the terminal since the last reading   */
+/*          to the bytes sent, and take it out of the bandwidth budget.*/
+/***********************************************************************/
+
+void CursesGui::account(void)
+{
+    unsigned long now, writes;
+
+    meter(now, writes);
+    if (now < meterBytes)
+	now = meterBytes;
+    sentBytes += now - meterBytes;
+    tokens -= now - meterBytes;
+    meterBytes = now;
+}
+
+/***********************************************************************/
+/* Routine: meter(bytes,writes)                                        */
+/* Purpose: Bytes and write() calls sent to the terminal so far, as    */
+/*          counted by writeFrame(). Nothing else written, to files or */
+/*          to the headless input, is counted.                         */
+/***********************************************************************/
+
+void CursesGui::meter(unsigned long &bytes, unsigned long &writes)
+{
+    bytes = termBytes;
+    writes = termWrites;
+}
+
+/***********************************************************************/
+/* Routine: colorAttr(attr,mono)                                       */
+/* Purpose: To strip the color from an attribute when colors are off,  */
+/*          adding mono in its place so highlights stay visible.       */
+/***********************************************************************/
+
+chtype CursesGui::colorAttr(chtype attr, chtype mono)
+{
+    if (colorsOn)
+	return attr;
+    return (attr & ~A_COLOR) | mono;
+}
+
+/***********************************************************************/
+/* Routine: frame(WINDOW)                                              */
+/* Purpose: To draw a window border: line graphics normally, plain     */
+/*          ASCII on a low-bandwidth line.                             */
+/***********************************************************************/
+
+void CursesGui::frame(WINDOW * win)
+{
+    if (bandwidth > 0)
+	wborder(win, '|', '|', '-', '-', '+', '+', '+', '+');
+    else
+	box(win, 0, 0);
+}
+
+
+/***********************************************************************/
+/* Routine: setSyncOutput(bool)                                        */
+/* Purpose: To wrap every frame in the synchronized update mode (DEC   */
+/*          private mode 2026), so big repaints never tear. It is on   */
+/*          by default when the terminal description has the Sync     */
+/*          capability; turning it on elsewhere sends the standard     */
+/*          sequence, which terminals without the mode ignore.         */
+/***********************************************************************/
+
+void CursesGui::setSyncOutput(bool on)
+{
+    syncOutput = on;
+}
+
+/***********************************************************************/
+/* Routine: writeFrame()                                               */
+/* Purpose: To run doupdate() with the terminal's descriptor pointed   */
+/*          at a scratch file, then send what it wrote in one write(), */
+/*          between the synchronized update marks when they are on.    */
+/*          ncurses 6 writes past stdio and flushes at every cursor    */
+/*          move, so this is where a frame is made whole. Terminal     */
+/*          modes are never set inside doupdate(). The terminal's      */
+/*          descriptor is kept in termFd for the life of the screen,   */
+/*          and frames follow one another in the scratch file until   */
+/*          it holds FRAMESCRATCH bytes, so a frame costs few calls.   */
+/***********************************************************************/
+
+void CursesGui::writeFrame(void)
+{
+    int fd;
+    off_t end, len;
+    size_t head, done;
+    ssize_t n;
+
+    if (screenOut == NULL || frameFd == -1 || termFd == -1) {
+	doupdate();
+	sentFrames++;
+	return;
+    }
+    fd = fileno(screenOut);
+    dup2(frameFd, fd);
+    doupdate();
+    fflush(screenOut);
+    dup2(termFd, fd);
+
+    end = lseek(frameFd, 0, SEEK_CUR);
+    len = end - frameAt;
+    if (len <= 0)
+	return;
+    sentFrames++;
+    frameBuf.clear();
+    if (syncOutput)
+	frameBuf = syncBegin;
+    head = frameBuf.size();
+    frameBuf.resize(head + len);
+    n = pread(frameFd, &frameBuf[head], len, frameAt);
+    frameBuf.resize(head + (n > 0 ? n : 0));
+    if (syncOutput)
+	frameBuf += syncEnd;
+    frameAt = end;
+    if (frameAt >= FRAMESCRATCH) {
+	lseek(frameFd, 0, SEEK_SET);
+	if (ftruncate(frameFd, 0) == -1)
+	    cerr << "Error: cannot reset the frame buffer" << endl;
+	frameAt = 0;
+    }
+    done = 0;
+    while (done < frameBuf.size()) {
+	n = write(fd, frameBuf.data() + done, frameBuf.size() - done);
+	termWrites++;
+	if (n > 0)
+	    done += n;
+	else if (n == 0 || errno != EINTR)
+	    break;
+    }
+    termBytes += done;
+}
+
+
+/***********************************************************************/
+/* Routine: setStats(bool) / getStats() / resetStats()                 */
+/* Purpose: To find out which calls are expensive on the wire. While   */
+/*          on, the bytes and write() calls sent to the terminal and   */
+/*          the time spent in doupdate() are charged to the public     */
+/*          method that caused them; calls made from inside another    */
+/*          method count towards the outer one.                        */
+/***********************************************************************/
+
+void CursesGui::setStats(bool on)
+{
+    statsOn = on;
+}
+
+vector < CursesCallStats > CursesGui::getStats(void)
+{
+    vector < CursesCallStats > all;
+    map < string, CursesCallStats >::iterator it;
+
+    for (it = stats.begin(); it != stats.end(); ++it)
+	all.push_back(it->second);
+    return all;
+}
+
+void CursesGui::resetStats(void)
+{
+    stats.clear();
+}
+
+
+/***********************************************************************/
+/* Class: CallScope                                                    */
+/* Purpose: Charges the output of a public method to it, from the      */
+/*          write counters read on entry and on exit.                  */
+/***********************************************************************/
+
+CursesGui::CallScope::CallScope(CursesGui * g, const char *method)
+{
+    gui = g;
+    outer = false;
+    if (!gui->statsOn || gui->callMethod != NULL)
+	return;
+    outer = true;
+    gui->callMethod = method;
+    gui->callRefresh = 0;
+    gui->meter(bytes, writes);
+}
+
+CursesGui::CallScope::~CallScope()
+{
+    unsigned long b, w;
+
+    if (!outer)
+	return;
+    gui->meter(b, w);
+    CursesCallStats & st = gui->stats[gui->callMethod];
+    st.method = gui->callMethod;
+    st.calls++;
+    st.bytes += b - bytes;
+    st.writes += w - writes;
+    st.refreshTime += gui->callRefresh;
+    gui->callMethod = NULL;
+}
+
+
+/***********************************************************************/
+/* Routine: elapsedSince(time)                                         */
+/* Purpose: Seconds from a time to now.                                */
+/***********************************************************************/
+
+double CursesGui::elapsedSince(const struct timeval &from)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - from.tv_sec) + (now.tv_usec - from.tv_usec) / 1e6;
+}
+
+
+/***********************************************************************/
+/* Routine: readKey(WINDOW)                                            */
+/* Purpose: wgetch() for the widget loops, noting when the key came    */
+/*          in so keyPainted() can tell how long it took to show.      */
+/*          While it waits, a frame held back by the bandwidth budget  */
+/*          is sent once the budget allows.                            */
+/***********************************************************************/
+
+int CursesGui::readKey(WINDOW * win)
+{
+    int ch, delay, want, wait;
+
+    /* headless: keys left in the queue go in as the pipe drains, and */
+    /* a read that would block waits HEADLESSWAIT ms at most          */
+    delay = want = win->_delay;
+    if (keyPipe != -1) {
+	feedKeys();
+	if (want < 0 || want > HEADLESSWAIT)
+	    want = HEADLESSWAIT;
+    }
+    /* a frame held back for the budget goes out as soon as the line  */
+    /* has room for it, not when the next key happens to come in      */
+    for (;;) {
+	wait = heldFor();
+	if (wait == 0) {
+	    sendFrame(false);
+	    continue;
+	}
+	if (wait < 0 || (want >= 0 && want <= wait)) {
+	    wtimeout(win, want);
+	    ch = wgetch(win);
+	    break;
+	}
+	wtimeout(win, wait);
+	ch = wgetch(win);
+	if (ch != ERR)
+	    break;
+	sendFrame(false);
+	if (want > 0)
+	    want -= wait;
+    }
+    wtimeout(win, delay);
+    if (ch == ERR)
+	return ch;
+    gettimeofday(&keyTime, NULL);
+    keyPending = true;
+    keyFrames = sentFrames;
+    return ch;
+}
+
+/***********************************************************************/
+/* Routine: keyPainted(widget)                                         */
+/* Purpose: To record the latency of the last key read once the frame  */
+/*          it caused has been sent. Keys after which no frame changed */
+/*          the screen, such as a scroll past the end, are not         */
+/*          counted.                                                   */
+/***********************************************************************/
+
+void CursesGui::keyPainted(const char *widget)
+{
+    LatencyHist *hist;
+    double secs;
+    int i;
+
+    if (!keyPending)
+	return;
+    keyPending = false;
+    if (sentFrames == keyFrames)
+	return;
+    secs = elapsedSince(keyTime);
+    hist = &latency[widget];
+    i = secs > 1e-6 ? (int) ceil(4 * log2(secs * 1e6)) : 0;
+    if (i >= LATENCYBUCKETS)
+	i = LATENCYBUCKETS - 1;
+    hist->bucket[i]++;
+    hist->keys++;
+    if (secs > hist->max)
+	hist->max = secs;
+}
+
+/***********************************************************************/
+/* Routine: LatencyHist::percentile(fraction)                          */
+/* Purpose: Upper bound of the bucket holding the given fraction of    */
+/*          the keys, in seconds, never above the worst key seen.      */
+/***********************************************************************/
+
+double CursesGui::LatencyHist::percentile(double fraction) const
+{
+    unsigned long want, seen;
+    double bound;
+    int i;
+
+    want = (unsigned long) ceil(fraction * keys);
+    seen = 0;
+    for (i = 0; i < LATENCYBUCKETS; i++) {
+	seen += bucket[i];
+	if (seen >= want && seen > 0)
+	    break;
+    }
+    bound = pow(2.0, i / 4.0) / 1e6;
+    return bound < max ? bound : max;
+}
+
+/***********************************************************************/
+/* Routine: getLatency() / dumpLatency(file) / resetLatency()          */
+/* Purpose: Key-to-paint latency per widget (showMenu, messageBox,     */
+/*          yesno, dialogBox, view): the time from wgetch() returning  */
+/*          to the end of the flush that shows the key's effect.       */
+/***********************************************************************/
+
+vector < CursesLatency > CursesGui::getLatency(void)
+{
+    vector < CursesLatency > all;
+    map < string, LatencyHist >::iterator it;
+    CursesLatency lat;
+
+    for (it = latency.begin(); it != latency.end(); ++it) {
+	lat.widget = it->first;
+	lat.keys = it->second.keys;
+	lat.p50 = it->second.percentile(0.50);
+	lat.p99 = it->second.percentile(0.99);
+	lat.max = it->second.max;
+	all.push_back(lat);
+    }
+    return all;
+}
+
+bool CursesGui::dumpLatency(string fname)
+{
+    vector < CursesLatency > all = getLatency();
+    ofstream out(fname.c_str());
+    char line[128];
+
+    if (!out) {
+	cerr << "Error opening file " << fname << endl;
+	return false;
+    }
+    out << "# widget keys p50_ms p99_ms max_ms" << endl;
+    for (size_t i = 0; i < all.size(); i++) {
+	snprintf(line, sizeof(line), "%s %lu %.3f %.3f %.3f",
+		 all[i].widget.c_str(), all[i].keys, all[i].p50 * 1e3,
+		 all[i].p99 * 1e3, all[i].max * 1e3);
+	out << line << endl;
+    }
+    return out.good();
+}
+
+void CursesGui::resetLatency(void)
+{
+    latency.clear();
+    keyPending = false;
+}
+
+/***********************************************************************/
+/* Routine: setRowCache(cells) / getRowCache()                         */
+/* Purpose: The cache of lines laid out by the viewers: how many cells */
+/*          it may take (0 keeps only the line laid out last), and how */
+/*          often a line shown was found in it.                        */
+/***********************************************************************/
+
+void CursesGui::setRowCache(unsigned long cells)
+{
+    rowLru.clear();
+    rowIndex.clear();
+    rowLimit = cells;
+    rowCells = 0;
+    rowHits = rowMisses = 0;
+}
+
+CursesRowCache CursesGui::getRowCache(void)
+{
+    CursesRowCache rc;
+
+    rc.hits = rowHits;
+    rc.misses = rowMisses;
+    rc.lines = rowLru.size();
+    rc.cells = rowCells;
+    return rc;
+}
+
+
 int CursesGui::getLines()
 {
   return LINES;
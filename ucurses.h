@@ -7,6 +7,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include "ncurses.h"
 #include "form.h"
 #include <menu.h>
@@ -20,9 +21,89 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <math.h>
+#include <locale.h>
+#include <langinfo.h>
+
+class Document;
+class MappedFile;
+class Search;
+
+// A rectangle of cells inside a window
+struct CursesRect {
+    int y, x, lines, cols;
+};
+
+// Cells of a window as last sent to the screen, used by damage tracking
+struct CellShadow {
+    int begy, begx, lines, cols;
+    std::vector < chtype > cells;
+    std::vector < unsigned long > hash;	// per-row hash of cells
+    std::vector < char > valid;	// row known to be what is on screen
+};
+
+// Terminal output charged to one public CursesGui method
+struct CursesCallStats {
+    std::string method;
+    unsigned long calls;
+    unsigned long bytes;	// bytes written
+    unsigned long writes;	// write() system calls
+    double refreshTime;		// seconds spent in doupdate()
+
+    CursesCallStats() : calls(0), bytes(0), writes(0), refreshTime(0) {}
+};
+
+// Time from a key arriving in a widget to the screen showing its effect
+struct CursesLatency {
+    std::string widget;
+    unsigned long keys;
+    double p50, p99, max;	// seconds
+};
+
+// Lines laid out by the viewers and kept to be shown again
+struct CursesRowCache {
+    unsigned long hits;
+    unsigned long misses;	// lines laid out anew
+    unsigned long lines;	// kept now
+    unsigned long cells;	// the cells they take
+};
+
+// A line of a document as laid out for the viewers, margin included,
+// or of a long one the slice of it around where it is shown
+struct RowCells {
+    Document *doc;
+    long line;
+    size_t len;			// bytes of text
+    size_t width;		// cells the whole line takes
+    size_t from;		// cell the first of cells is
+    size_t at, end;		// bytes laid out
+    chtype attr;
+    std::vector < chtype > cells;
+};
+
+// A file open in the tabbed viewer, and where it was left
+struct ViewTab {
+    std::string name;
+    Document *doc;		// what is shown
+    MappedFile *file;		// the file under it, if mapped
+    Search *search;		// kept across switches, like the rest
+    std::string cache;		// sidecar its index is saved to
+    long top_line;
+    int top_sub;
+    bool wrap;
+    int firstCol;
+};
+
+#define LATENCYBUCKETS 96	/* quarter-octave buckets from 1us to ~14s */
 
 class CursesGui {
   public:
@@ -50,22 +131,203 @@ class CursesGui {
     void delWindow(WINDOW *);
     std::string dialogBox(std::string, int);
     void wclrscr(WINDOW *);
+    void fillRect(WINDOW *, CursesRect, chtype ch, chtype attr);
+    void blitText(WINDOW *, CursesRect, const std::vector<std::string> &rows);
+    void copyRect(WINDOW *src, CursesRect, WINDOW *dst, int y, int x);
     void wCenterTitle(WINDOW *,  char const *);
     int fileView(std::string);
     int execView(std::string);
     int fileViewIPC(std::string fname);
+    int fileViewFilter(std::string fname, std::string regex);
+    int fileFollow(std::string fname);
+    int fileViewTabs(std::vector<std::string> fnames);
+
+    // frame-batched rendering: between beginFrame() and endFrame()
+    // screen updates are only staged and go out in a single doupdate()
+    void beginFrame(void);
+    void endFrame(void);
+
+    // headless mode: scripted input and the resulting cell grid
+    void pushKey(int);
+    void pushKeys(std::string);
+    std::vector<std::string> getScreen(void);
+    chtype getCell(int, int);
+
+    // damage tracking: only cells that really changed since the last
+    // refresh of a window are handed to ncurses
+    void setDamageTracking(bool);
+
+    // low-bandwidth profile for slow serial lines: updates are sent as
+    // frames within a bytes-per-second budget (0 turns it off) and
+    // frames are skipped while over budget; colors may be dropped
+    void setBandwidth(long bytesPerSecond);
+    void setColors(bool);
+    void flushFrame(void);
+    unsigned long bytesSent(void);
+    unsigned long framesSkipped(void);
+
+    // synchronized output (DEC mode 2026) around every frame
+    void setSyncOutput(bool);
+
+    // output accounting per public method
+    void setStats(bool);
+    std::vector<CursesCallStats> getStats(void);
+    void resetStats(void);
+
+    // line index of big files kept for the next fileView, off by
+    // default: in dir, or next to the file when dir is empty
+    void setIndexCache(bool on, std::string dir = "");
+
+    // key-to-paint latency of the interactive widgets
+    std::vector<CursesLatency> getLatency(void);
+    bool dumpLatency(std::string fname);
+    void resetLatency(void);
+
+    // bytes the tabbed viewer may take for the line indexes of its files
+    // and the lines kept laid out, together
+    void setViewBudget(unsigned long bytes);
+
+    // lines laid out by the viewers kept, up to a number of cells in all;
+    // setting it empties the cache and its counts
+    void setRowCache(unsigned long cells);
+    CursesRowCache getRowCache(void);
 
     // constructor and destructor
 
      CursesGui();
+     CursesGui(int lines, int cols);	// headless, in-memory screen
     ~CursesGui();
 
   private:
-    int countChars(std::string);
-    int view(std::string, int);
-    int countLines(std::string);
+    struct CallScope {
+	CursesGui *gui;
+	bool outer;
+	unsigned long bytes, writes;
+
+	CallScope(CursesGui *, const char *method);
+	~CallScope();
+    };
+
+    struct LatencyHist {
+	unsigned long keys;
+	double max;
+	unsigned long bucket[LATENCYBUCKETS];
+
+	LatencyHist() : keys(0), max(0) {
+	    memset(bucket, 0, sizeof(bucket));
+	}
+	double percentile(double) const;
+    };
+
+    int view(Document &, ViewTab * tab = NULL);
+    void openTab(ViewTab &);
+    void closeTab(ViewTab &);
+    void tabBar(const std::vector < ViewTab > &, size_t current);
+    void fitBudget(std::vector < ViewTab > &);
+    int viewFile(std::string fname, bool follow);
     int msgGet(void);
-    int viewN(std::string data, int lines);
+    int viewN(Document &);
+    void scrollBar(WINDOW *, long top, long total, int rows,
+		   const std::string & note = "");
+    int fillView(WINDOW *, Document &, int width, long top_line,
+		 int top_sub, long &bot_line, int &bot_sub);
+    std::string promptLine(WINDOW *, const char *label);
+    bool docRow(Document &, long line, int sub, int width,
+		std::vector < chtype > &);
+    bool stepRow(Document &, long &line, int &sub, int width, int dir);
+    int lineRows(Document &, long line, int width);
+    long lineWidth(Document &, long line);
+    int widestLine(Document &, long top_line, long bot_line);
+    void forgetRows(Document &, long from);
+    const RowCells *lineCells(Document &, long line, size_t col, int span);
+    void trimRows(void);
+    void lastPage(Document &, int width, int rows, long total,
+		  long &top_line, int &top_sub);
+    int appendRows(WINDOW *, Document &, int width, int rows,
+		   long &top_line, int &top_sub, long &bot_line,
+		   int &bot_sub);
+    void refreshWin(WINDOW *, bool repaint = false);
+    void init(void);
+    void setup(void);
+    void damage(WINDOW *, bool);
+    void invalidate(int, int, int, int, WINDOW *);
+    void forget(WINDOW *);
+    bool clipRect(WINDOW *, CursesRect &);
+    chtype cellAttr(WINDOW *);
+    chtype blankCell(WINDOW *);
+    void paint(WINDOW *);
+    void sendFrame(bool force);
+    void refill(void);
+    int heldFor(void);
+    void writeFrame(void);
+    void account(void);
+    void meter(unsigned long &bytes, unsigned long &writes);
+    double elapsedSince(const struct timeval &);
+    chtype colorAttr(chtype attr, chtype mono = 0);
+    void frame(WINDOW *);
+    void textCells(const char *, size_t len, size_t at, size_t end,
+		   size_t col, chtype, std::vector < chtype > &,
+		   const char *hl = NULL);
+    void cellByte(const char *, size_t len, size_t col, size_t &at,
+		  size_t &from);
+    int readKey(WINDOW *);
+    void feedKeys(void);
+    void keyPainted(const char *widget);
+
+    int frameDepth;
+    SCREEN *screen;		// from newterm(), NULL after initscr()
+    FILE *screenIn;
+    FILE *screenOut;
+    int keyPipe;
+    std::string keyQueue;	// keys pushed that the pipe had no room for
+    std::mutex keyLock;		// over keyQueue, pushed to from any thread
+    bool damageTracking;
+    std::map < WINDOW *, CellShadow > shadows;
+
+    long bandwidth;		// bytes per second, 0 = unlimited
+    double tokens;		// bytes that may still be sent
+    struct timeval lastFill;
+    bool colorsOn;
+    bool pendingFrame;
+    unsigned long sentBytes;
+    unsigned long skippedFrames;
+    unsigned long meterBytes;	// last reading of the write counter
+    unsigned long termBytes;	// sent to the terminal by writeFrame()
+    unsigned long termWrites;	// in so many write() calls
+    unsigned long sentFrames;	// frames that changed the screen
+    bool syncOutput;
+    std::string syncBegin;
+    std::string syncEnd;
+    int frameFd;		// scratch file a frame is gathered in
+    off_t frameAt;		// where the next frame starts in it
+    int termFd;			// the terminal, while frames go to frameFd
+    std::string frameBuf;	// the frame, between its sync marks
+
+    bool statsOn;
+    const char *callMethod;	// outermost public method running
+    double callRefresh;
+    std::map < std::string, CursesCallStats > stats;
+
+    struct timeval keyTime;	// when the last key was read
+    bool keyPending;		// its effect is not on the screen yet
+    unsigned long keyFrames;	// frames sent before it was read
+    std::map < std::string, LatencyHist > latency;
+
+    bool indexCache;
+    std::string indexDir;
+    Search *finder;		// search running in view(), if any
+    bool wrapOn;		// view() wraps long lines, else scrolls across
+    int firstCol;		// columns scrolled off to the left when not
+    Document *wrapDoc;		// rows each line of wrapDoc wraps to at
+    int wrapWidth;		// wrapWidth, for the lines met so far
+    std::map < long, int >wrapRows;
+    std::list < RowCells > rowLru;	// most recently shown first
+    std::map < std::pair < Document *, long >,
+	std::list < RowCells >::iterator > rowIndex;
+    unsigned long rowLimit;	// cells rowLru may take
+    unsigned long rowCells;	// cells it takes
+    unsigned long rowHits, rowMisses;
+    unsigned long viewBudget;	// bytes for fileViewTabs
 
 
 };
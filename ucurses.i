@@ -35,3 +35,7 @@
 int newMenu(array_in(T),int);
 %}
 %include "ucurses.h"
+
+%template(StringVector) std::vector<std::string>;
+%template(CallStatsVector) std::vector<CursesCallStats>;
+%template(LatencyVector) std::vector<CursesLatency>;
@@ -0,0 +1,2301 @@
+// Curses GUI utilities: documents shown by the file viewers
+
+#include "uview.h"
+#include <stdlib.h>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NEWLINE_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/***********************************************************************/
+/* Newline kernels. Each compares a vector of bytes against '\n' at a  */
+/* time and turns the result into a bit mask: counting is a popcount   */
+/* of the mask, finding walks its set bits. The tail shorter than a    */
+/* vector is done byte by byte.                                        */
+/***********************************************************************/
+
+static long countScalar(const char *text, size_t len)
+{
+    long n = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	n += text[i] == '\n';
+    return n;
+}
+
+static off_t *findScalar(const char *text, size_t len, off_t base,
+			 off_t * out)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	if (text[i] == '\n')
+	    *out++ = base + i + 1;
+    return out;
+}
+
+#ifdef NEWLINE_SIMD
+
+__attribute__ ((target("sse2")))
+static long countSSE2(const char *text, size_t len)
+{
+    __m128i nl = _mm_set1_epi8('\n');
+    long n = 0;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *) (text + i));
+	n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+    }
+    return n + countScalar(text + i, len - i);
+}
+
+__attribute__ ((target("sse2")))
+static off_t *findSSE2(const char *text, size_t len, off_t base,
+		       off_t * out)
+{
+    __m128i nl = _mm_set1_epi8('\n');
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *) (text + i));
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+	while (mask != 0) {
+	    *out++ = base + i + __builtin_ctz(mask) + 1;
+	    mask &= mask - 1;
+	}
+    }
+    return findScalar(text + i, len - i, base + i, out);
+}
+
+__attribute__ ((target("avx2,popcnt")))
+static long countAVX2(const char *text, size_t len)
+{
+    __m256i nl = _mm256_set1_epi8('\n');
+    long n = 0;
+    size_t i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+	__m256i a = _mm256_loadu_si256((const __m256i *) (text + i));
+	__m256i b = _mm256_loadu_si256((const __m256i *) (text + i + 32));
+	n += __builtin_popcount(_mm256_movemask_epi8
+				(_mm256_cmpeq_epi8(a, nl)));
+	n += __builtin_popcount(_mm256_movemask_epi8
+				(_mm256_cmpeq_epi8(b, nl)));
+    }
+    return n + countScalar(text + i, len - i);
+}
+
+__attribute__ ((target("avx2")))
+static off_t *findAVX2(const char *text, size_t len, off_t base,
+		       off_t * out)
+{
+    __m256i nl = _mm256_set1_epi8('\n');
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) (text + i));
+	mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+	while (mask != 0) {
+	    *out++ = base + i + __builtin_ctz(mask) + 1;
+	    mask &= mask - 1;
+	}
+    }
+    return findScalar(text + i, len - i, base + i, out);
+}
+
+#endif
+
+struct NewlineKernel {
+    const char *name;
+    long (*count) (const char *, size_t);
+    off_t *(*find) (const char *, size_t, off_t, off_t *);
+};
+
+#ifdef NEWLINE_SIMD
+// UCURSES_KERNEL=avx2, sse2 or scalar caps the kernel picked, so that
+// the narrower ones can be timed and checked on a wider CPU.
+
+static bool kernelAllowed(const char *name)
+{
+    static const char *names[] = { "scalar", "sse2", "avx2" };
+    const char *want;
+    int i, w;
+
+    want = getenv("UCURSES_KERNEL");
+    if (want == NULL)
+	return true;
+    for (w = 0; w < 3 && strcmp(want, names[w]) != 0; w++);
+    for (i = 0; i < 3 && strcmp(name, names[i]) != 0; i++);
+    return w == 3 || i <= w;
+}
+#endif
+
+static NewlineKernel chooseKernel(void)
+{
+    NewlineKernel k = { "scalar", countScalar, findScalar };
+
+#ifdef NEWLINE_SIMD
+    __builtin_cpu_init();
+    if (kernelAllowed("avx2") && __builtin_cpu_supports("avx2")
+	&& __builtin_cpu_supports("popcnt")) {
+	k.name = "avx2";
+	k.count = countAVX2;
+	k.find = findAVX2;
+    } else if (kernelAllowed("sse2") && __builtin_cpu_supports("sse2")) {
+	k.name = "sse2";
+	k.count = countSSE2;
+	k.find = findSSE2;
+    }
+#endif
+    return k;
+}
+
+static const NewlineKernel &kernel(void)
+{
+    static const NewlineKernel k = chooseKernel();
+
+    return k;
+}
+
+long countNewlines(const char *text, size_t len)
+{
+    return kernel().count(text, len);
+}
+
+off_t *findNewlines(const char *text, size_t len, off_t base, off_t * out)
+{
+    return kernel().find(text, len, base, out);
+}
+
+const char *newlineKernel(void)
+{
+    return kernel().name;
+}
+
+/***********************************************************************/
+/* Text kernels. plainBytes flags the control characters, C0 and C1    */
+/* (0x80 to 0x9f), the bytes with neither bit 5 nor bit 6 set, and DEL */
+/* a vector at a time and stops at the first; hexBytes splits a vector */
+/* of bytes into nibbles, interleaves them high first, and makes each  */
+/* a digit by adding '0', plus 'a' - '0' - 10 where it is over 9.      */
+/***********************************************************************/
+
+static size_t plainScalar(const char *text, size_t len)
+{
+    size_t i;
+    unsigned char c;
+
+    for (i = 0; i < len; i++) {
+	c = text[i];
+	if ((c & 0x60) == 0 || c == 127)
+	    break;
+    }
+    return i;
+}
+
+static void hexScalar(const unsigned char *in, size_t len, char *out)
+{
+    static const char digit[] = "0123456789abcdef";
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+	*out++ = digit[in[i] >> 4];
+	*out++ = digit[in[i] & 15];
+    }
+}
+
+#ifdef NEWLINE_SIMD
+
+__attribute__ ((target("sse2")))
+static size_t plainSSE2(const char *text, size_t len)
+{
+    __m128i bits = _mm_set1_epi8(0x60), del = _mm_set1_epi8(127);
+    __m128i zero = _mm_setzero_si128();
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *) (text + i));
+	mask = _mm_movemask_epi8(_mm_or_si128
+				 (_mm_cmpeq_epi8(_mm_and_si128(v, bits), zero),
+				  _mm_cmpeq_epi8(v, del)));
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+    return i + plainScalar(text + i, len - i);
+}
+
+__attribute__ ((target("avx2")))
+static size_t plainAVX2(const char *text, size_t len)
+{
+    __m256i bits = _mm256_set1_epi8(0x60), del = _mm256_set1_epi8(127);
+    __m256i zero = _mm256_setzero_si256();
+    unsigned int mask;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) (text + i));
+	mask = _mm256_movemask_epi8(_mm256_or_si256
+				    (_mm256_cmpeq_epi8
+				     (_mm256_and_si256(v, bits), zero),
+				     _mm256_cmpeq_epi8(v, del)));
+	if (mask != 0)
+	    return i + __builtin_ctz(mask);
+    }
+    return i + plainScalar(text + i, len - i);
+}
+
+__attribute__ ((target("sse2")))
+static void hexSSE2(const unsigned char *in, size_t len, char *out)
+{
+    __m128i nibble = _mm_set1_epi8(15), nine = _mm_set1_epi8(9);
+    __m128i zero = _mm_set1_epi8('0'), gap = _mm_set1_epi8('a' - '0' - 10);
+    __m128i v, hi, lo, a, b;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	v = _mm_loadu_si128((const __m128i *) (in + i));
+	hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+	lo = _mm_and_si128(v, nibble);
+	a = _mm_unpacklo_epi8(hi, lo);
+	b = _mm_unpackhi_epi8(hi, lo);
+	a = _mm_add_epi8(_mm_add_epi8(a, zero),
+			 _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+	b = _mm_add_epi8(_mm_add_epi8(b, zero),
+			 _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+	_mm_storeu_si128((__m128i *) (out + 2 * i), a);
+	_mm_storeu_si128((__m128i *) (out + 2 * i + 16), b);
+    }
+    hexScalar(in + i, len - i, out + 2 * i);
+}
+
+#endif
+
+struct TextKernel {
+    size_t (*plain) (const char *, size_t);
+    void (*hex) (const unsigned char *, size_t, char *);
+};
+
+static TextKernel chooseTextKernel(void)
+{
+    TextKernel k = { plainScalar, hexScalar };
+
+#ifdef NEWLINE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+	k.plain = plainSSE2;
+	k.hex = hexSSE2;
+    }
+    if (__builtin_cpu_supports("avx2"))
+	k.plain = plainAVX2;
+#endif
+    return k;
+}
+
+static const TextKernel &textKernel(void)
+{
+    static const TextKernel k = chooseTextKernel();
+
+    return k;
+}
+
+size_t plainBytes(const char *text, size_t len)
+{
+    return textKernel().plain(text, len);
+}
+
+void hexBytes(const unsigned char *in, size_t len, char *out)
+{
+    textKernel().hex(in, len, out);
+}
+
+
+Document::Document()
+{
+    data = NULL;
+    size = 0;
+    scanned = 0;
+    loading = false;
+    stopLoad = false;
+}
+
+Document::~Document()
+{
+    stopLoading();
+}
+
+/***********************************************************************/
+/* Routine: setText(text,len)                                          */
+/* Purpose: To start over on new text, with nothing indexed yet.       */
+/*          Empty text has no lines.                                   */
+/***********************************************************************/
+
+void Document::setText(const char *text, size_t len)
+{
+    data = text;
+    size = len;
+    scanned = 0;
+    starts.clear();
+    if (size > 0)
+	starts.push_back(0);
+}
+
+/***********************************************************************/
+/* Routine: indexTo(n)                                                 */
+/* Purpose: To find line starts until line n+1 is known, so line n's   */
+/*          end is too, or the text ends. Text is indexed a block at a */
+/*          time.                                                      */
+/***********************************************************************/
+
+void Document::indexTo(long n)
+{
+    off_t found[INDEXBLOCK], *end;
+    size_t len;
+
+    while ((long) starts.size() <= n + 1 && scanned < size) {
+	len = size - scanned < INDEXBLOCK ? size - scanned : INDEXBLOCK;
+	end = findNewlines(data + scanned, len, scanned, found);
+	scanned += len;
+	if (scanned == size && end > found && end[-1] == (off_t) size)
+	    end--;
+	starts.insert(starts.end(), found, end);
+    }
+}
+
+bool Document::hasLine(long n)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    if (n < 0)
+	return false;
+    indexTo(n);
+    return n < (long) starts.size();
+}
+
+/***********************************************************************/
+/* Routine: line(n,len)                                                */
+/* Purpose: Line n straight from the text, NULL past the end.          */
+/***********************************************************************/
+
+const char *Document::line(long n, size_t & len)
+{
+    size_t end;
+    lock_guard < mutex > hold(indexLock);
+
+    len = 0;
+    if (n < 0)
+	return NULL;
+    indexTo(n);
+    if (n >= (long) starts.size())
+	return NULL;
+    if (n + 1 < (long) starts.size())
+	end = starts[n + 1] - 1;
+    else if (data[size - 1] == '\n')
+	end = size - 1;
+    else
+	end = size;
+    len = end - starts[n];
+    return data + starts[n];
+}
+
+long Document::lineCount(void)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    if (!loading)
+	indexAll();
+    return starts.size();
+}
+
+/***********************************************************************/
+/* Routine: load()                                                     */
+/* Purpose: To index the rest of the document in the background, so a  */
+/*          viewer can show its first screen at once and take in the   */
+/*          line count as it grows, whatever the size of the document. */
+/***********************************************************************/
+
+void Document::load(void)
+{
+    if (loading || loaded())
+	return;
+    if (loader.joinable())
+	loader.join();
+    stopLoad = false;
+    loading = true;
+    loader = thread(&Document::loadRun, this);
+}
+
+void Document::loadRun(void)
+{
+    while (!stopLoad && loadMore());
+    loading = false;
+}
+
+void Document::waitLoaded(void)
+{
+    if (loader.joinable())
+	loader.join();
+}
+
+void Document::stopLoading(void)
+{
+    stopLoad = true;
+    if (loader.joinable())
+	loader.join();
+}
+
+bool Document::loaded(void)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    return scanned >= size;
+}
+
+/***********************************************************************/
+/* Routine: loadMore()                                                 */
+/* Purpose: To index the next INDEXCHUNK bytes for each core, on all   */
+/*          of them, for load(). They are scanned without the lock,    */
+/*          the text being read only; the offsets are then added under */
+/*          it, less any the viewer found for itself meanwhile.        */
+/***********************************************************************/
+
+bool Document::loadMore(void)
+{
+    vector < off_t > found;
+    vector < off_t >::iterator from;
+    size_t lo, hi, most;
+
+    {
+	lock_guard < mutex > hold(indexLock);
+
+	lo = scanned;
+    }
+    if (lo >= size)
+	return false;
+    most = (size_t) INDEXCHUNK * cores();
+    hi = size - lo > most ? lo + most : size;
+    startsIn(data, lo, hi, size, found);
+
+    lock_guard < mutex > hold(indexLock);
+    if (scanned >= hi)
+	return scanned < size;
+    from = upper_bound(found.begin(), found.end(), (off_t) scanned);
+    starts.insert(starts.end(), from, found.end());
+    scanned = hi;
+    return scanned < size;
+}
+
+/***********************************************************************/
+/* Routine: indexAll()                                                 */
+/* Purpose: To index what is left of the document on all cores, with  */
+/*          indexLock held.                                            */
+/***********************************************************************/
+
+void Document::indexAll(void)
+{
+    startsIn(data, scanned, size, size, starts);
+    scanned = size;
+}
+
+/***********************************************************************/
+/* Routine: cores()                                                    */
+/* Purpose: The threads worth starting to index, one for each core.    */
+/***********************************************************************/
+
+unsigned int Document::cores(void)
+{
+    unsigned int n = thread::hardware_concurrency();
+
+    return n > 0 ? n : 1;
+}
+
+/***********************************************************************/
+/* Routine: startsIn(text,from,to,size,out)                            */
+/* Purpose: To append the line starts in [from,to) to out. Each thread */
+/*          counts the line starts in its chunk, a prefix sum of the   */
+/*          counts says where each chunk's offsets go, and the threads */
+/*          then write them there in a second pass. Less than a chunk  */
+/*          for each of two threads is indexed in this one.            */
+/***********************************************************************/
+
+void Document::startsIn(const char *text, size_t from, size_t to,
+			size_t size, vector < off_t > &out)
+{
+    unsigned int n, i;
+    size_t chunk;
+    vector < size_t > lo, hi;
+    vector < long >count, base;
+    vector < thread > workers;
+
+    if (from >= to)
+	return;
+    n = cores();
+    if (n > (to - from) / INDEXCHUNK)
+	n = (to - from) / INDEXCHUNK;
+    if (n < 2) {
+	chunk = out.size();
+	out.resize(chunk + countStarts(text, from, to, size));
+	if (out.size() > chunk)
+	    findStarts(text, from, to, size, &out[chunk]);
+	return;
+    }
+
+    chunk = (to - from + n - 1) / n;
+    lo.resize(n);
+    hi.resize(n);
+    count.resize(n);
+    base.resize(n);
+    for (i = 0; i < n; i++) {
+	lo[i] = from + i * chunk;
+	hi[i] = lo[i] + chunk < to ? lo[i] + chunk : to;
+    }
+
+    for (i = 0; i < n; i++)
+	workers.push_back(thread([&, i]() {
+	    count[i] = countStarts(text, lo[i], hi[i], size);
+	}));
+    for (i = 0; i < n; i++)
+	workers[i].join();
+    workers.clear();
+
+    base[0] = out.size();
+    for (i = 1; i < n; i++)
+	base[i] = base[i - 1] + count[i - 1];
+    out.resize(base[n - 1] + count[n - 1]);
+
+    for (i = 0; i < n; i++)
+	workers.push_back(thread([&, i]() {
+	    if (count[i] > 0)
+		findStarts(text, lo[i], hi[i], size, &out[base[i]]);
+	}));
+    for (i = 0; i < n; i++)
+	workers[i].join();
+}
+
+/***********************************************************************/
+/* Routine: countStarts(text,from,to,size) / findStarts(...,out)       */
+/* Purpose: The lines starting after a newline in [from,to): how many  */
+/*          there are, and their offsets. A newline ending the text    */
+/*          starts no line, so it is left out of the range.            */
+/***********************************************************************/
+
+long Document::countStarts(const char *text, size_t from, size_t to,
+			   size_t size)
+{
+    if (to == size && to > from && text[to - 1] == '\n')
+	to--;
+    return countNewlines(text + from, to - from);
+}
+
+void Document::findStarts(const char *text, size_t from, size_t to,
+			  size_t size, off_t * out)
+{
+    if (to == size && to > from && text[to - 1] == '\n')
+	to--;
+    findNewlines(text + from, to - from, from, out);
+}
+
+/***********************************************************************/
+/* Routine: findTime(t)                                                */
+/* Purpose: Binary search of a time-ordered document for the first     */
+/*          line stamped at or after t: O(log n) lines are looked at,  */
+/*          none of the text in between. Lines without a timestamp     */
+/*          (continuations of a message) are stepped over at a probe.  */
+/*          Returns the line count when every stamp is before t.       */
+/***********************************************************************/
+
+long Document::findTime(const LineTime & t)
+{
+    long lo, hi, mid, at;
+    LineTime stamp;
+
+    lo = 0;
+    hi = lineCount();
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	at = stampedLine(mid, hi, stamp);
+	if (at < 0)
+	    hi = mid;
+	else if (timeBefore(stamp, t))
+	    lo = at + 1;
+	else
+	    hi = at;
+    }
+    return lo;
+}
+
+/***********************************************************************/
+/* Routine: stampedLine(from,to,t)                                     */
+/* Purpose: The first line in [from,to) with a timestamp, looking at   */
+/*          no more than TIMEPROBE lines; -1 if there is none.         */
+/***********************************************************************/
+
+long Document::stampedLine(long from, long to, LineTime & t)
+{
+    const char *text;
+    size_t len;
+    long n;
+
+    for (n = from; n < to && n < from + TIMEPROBE; n++) {
+	text = line(n, len);
+	if (text != NULL && parseTime(text, len, t))
+	    return n;
+    }
+    return -1;
+}
+
+/***********************************************************************/
+/* Routine: parseTime(text,len,t)                                      */
+/* Purpose: To find the timestamp of a log line in its first 64 bytes: */
+/*          a time HH:MM[:SS], and before it, if there is one, a date  */
+/*          YYYY-MM-DD, YYYY/MM/DD or a syslog "Mon DD". The same      */
+/*          parser reads what the user types to go to.                 */
+/***********************************************************************/
+
+static int digits(const char *p, int n)
+{
+    int i, v;
+
+    for (i = v = 0; i < n; i++) {
+	if (p[i] < '0' || p[i] > '9')
+	    return -1;
+	v = v * 10 + p[i] - '0';
+    }
+    return v;
+}
+
+bool parseTime(const char *text, size_t len, LineTime & t)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    const char *p, *end, *m;
+    int h, mi, sec, y, mo, d, i;
+
+    end = text + (len < 64 ? len : 64);
+    for (p = text; p + 5 <= end; p++) {
+	if (p > text && p[-1] >= '0' && p[-1] <= '9')
+	    continue;
+	h = digits(p, 2);
+	mi = p[2] == ':' ? digits(p + 3, 2) : -1;
+	if (h < 0 || h > 23 || mi < 0 || mi > 59)
+	    continue;
+	sec = 0;
+	if (p + 8 <= end && p[5] == ':' && digits(p + 6, 2) >= 0)
+	    sec = digits(p + 6, 2);
+	t.secs = h * 3600L + mi * 60 + sec;
+	t.day = -1;
+
+	/* a date just before the time */
+	for (i = 0; i + 10 <= p - text; i++) {
+	    m = text + i;
+	    y = digits(m, 4);
+	    mo = digits(m + 5, 2);
+	    d = digits(m + 8, 2);
+	    if (y >= 0 && mo > 0 && d > 0 && (m[4] == '-' || m[4] == '/')
+		&& m[7] == m[4])
+		t.day = y * 10000L + mo * 100 + d;
+	}
+	for (i = 0; t.day < 0 && i + 6 <= p - text; i++) {
+	    m = text + i;
+	    for (mo = 0; mo < 12; mo++)
+		if (strncmp(m, months + 3 * mo, 3) == 0)
+		    break;
+	    d = m[4] == ' ' ? digits(m + 5, 1) : digits(m + 4, 2);
+	    if (mo < 12 && m[3] == ' ' && d > 0)
+		t.day = (mo + 1) * 100L + d;
+	}
+	return true;
+    }
+    return false;
+}
+
+/***********************************************************************/
+/* Routine: timeBefore(a,b)                                            */
+/* Purpose: Whether a comes before b. Days are only compared when both */
+/*          have one, so a bare time finds that time of day.           */
+/***********************************************************************/
+
+bool timeBefore(const LineTime & a, const LineTime & b)
+{
+    if (a.day >= 0 && b.day >= 0 && a.day != b.day)
+	return a.day < b.day;
+    return a.secs < b.secs;
+}
+
+/***********************************************************************/
+/* Routine: lineOf(at) / lineStart(n) / text(len)                      */
+/* Purpose: Between byte offsets and line numbers, and the text of the */
+/*          whole document when it is all in memory.                   */
+/***********************************************************************/
+
+long Document::lineOf(off_t at)
+{
+    vector < off_t >::iterator it;
+    lock_guard < mutex > hold(indexLock);
+
+    while (scanned < size && (starts.empty() || starts.back() <= at))
+	indexTo(starts.size());
+    it = upper_bound(starts.begin(), starts.end(), at);
+    return it == starts.begin() ? 0 : it - starts.begin() - 1;
+}
+
+off_t Document::lineStart(long n)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    if (n < 0)
+	return size;
+    indexTo(n);
+    return n < (long) starts.size() ? starts[n] : (off_t) size;
+}
+
+const char *Document::text(size_t & len)
+{
+    len = data != NULL ? size : 0;
+    return data;
+}
+
+/***********************************************************************/
+/* Routine: span(at,from,len,more,buf) / findText() / textFound()      */
+/* Purpose: The text for scanning threads, and its length: in memory   */
+/*          it is one piece, and all of it is known from the start.    */
+/***********************************************************************/
+
+const char *Document::span(off_t at, off_t & from, size_t & len,
+			   size_t & more, string & buf)
+{
+    if (data == NULL || at < 0 || (size_t) at >= size)
+	return NULL;
+    from = 0;
+    len = size;
+    more = 0;
+    return data;
+}
+
+bool Document::findText(void)
+{
+    return false;
+}
+
+size_t Document::textFound(void)
+{
+    return size;
+}
+
+bool Document::growing(void)
+{
+    return loading;
+}
+
+size_t Document::memory(void)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    return starts.capacity() * sizeof(off_t);
+}
+
+string Document::status(void)
+{
+    char buf[32];
+    lock_guard < mutex > hold(indexLock);
+
+    if (!loading || size == 0)
+	return "";
+    snprintf(buf, sizeof(buf), " loading %d%% ",
+	     (int) (scanned * 100.0 / size));
+    return buf;
+}
+
+int Document::update(void)
+{
+    return FOLLOWSAME;
+}
+
+/***********************************************************************/
+/* Routine: highlight(n,len,s,hl)                                      */
+/* Purpose: To flag the bytes of line n, len long, in a match of s.    */
+/***********************************************************************/
+
+void Document::highlight(long n, size_t len, Search & s, vector < char >&hl)
+{
+    s.marks(lineStart(n), len, hl);
+}
+
+
+FilterDocument::FilterDocument(Document & src)
+{
+    source = &src;
+    compiled = false;
+    quit = false;
+    done = true;
+    reach = 0;
+}
+
+FilterDocument::~FilterDocument()
+{
+    stop();
+    if (compiled)
+	regfree(&re);
+}
+
+/***********************************************************************/
+/* Routine: start(regex)                                               */
+/* Purpose: To filter with a new POSIX extended regular expression,    */
+/*          dropping any filter running. False if it does not compile. */
+/***********************************************************************/
+
+bool FilterDocument::start(const string & regex)
+{
+    stop();
+    if (compiled)
+	regfree(&re);
+    compiled = regcomp(&re, regex.c_str(), REG_EXTENDED | REG_NOSUB) == 0;
+    if (!compiled)
+	return false;
+    expr = regex;
+    starts.clear();
+    reach = 0;
+    quit = false;
+    done = false;
+    worker = thread(&FilterDocument::run, this);
+    return true;
+}
+
+void FilterDocument::stop(void)
+{
+    quit = true;
+    if (worker.joinable())
+	worker.join();
+}
+
+/***********************************************************************/
+/* Routine: run()                                                      */
+/* Purpose: The filter thread: matches each line against the pattern   */
+/*          in place (REG_STARTEND, so nothing is copied) and adds the */
+/*          starts of those that match a chunk at a time. The text is  */
+/*          taken a piece at a time from the source; only a line that  */
+/*          runs on from one piece into the next is copied.            */
+/***********************************************************************/
+
+void FilterDocument::run(void)
+{
+    vector < off_t > hits;
+    string buf, carry;
+    const char *text, *p, *nl, *end, *stop;
+    off_t at, from, start;
+    size_t len, more, total;
+
+    /* a gzip file is inflated through first, to know its length */
+    while (!quit && source->findText());
+    total = source->textFound();
+    {
+	lock_guard < mutex > hold(lock);
+
+	size = total;
+    }
+    at = 0;
+    start = -1;			/* where the line in carry starts */
+    while ((size_t) at < total && !quit) {
+	more = 0;
+	text = source->span(at, from, len, more, buf);
+	if (text == NULL)
+	    break;
+	p = text + (at - from);
+	end = text + len;
+	while (p < end && !quit) {
+	    stop = end - p > FILTERCHUNK ? p + FILTERCHUNK : end;
+	    hits.clear();
+	    for (; p < stop; p = nl + 1) {
+		nl = (const char *) memchr(p, '\n', end - p);
+		if (nl == NULL && from + len < total) {
+		    /* the line goes on in the next piece */
+		    if (start < 0)
+			start = from + (p - text);
+		    carry.append(p, end - p);
+		    p = end;
+		    break;
+		}
+		if (nl == NULL)
+		    nl = end;
+		if (start >= 0) {
+		    carry.append(p, nl - p);
+		    if (matches(carry.data(), carry.size()))
+			hits.push_back(start);
+		    carry.clear();
+		    start = -1;
+		} else if (matches(p, nl - p))
+		    hits.push_back(from + (p - text));
+	    }
+	    at = from + (p - text);
+	    if ((size_t) at > total)
+		at = total;
+	    lock_guard < mutex > hold(lock);
+	    starts.insert(starts.end(), hits.begin(), hits.end());
+	    reach = at;
+	}
+    }
+    done = true;
+}
+
+bool FilterDocument::matches(const char *text, size_t len)
+{
+    regmatch_t m;
+
+    m.rm_so = 0;
+    m.rm_eo = len;
+    return regexec(&re, text, 1, &m, REG_STARTEND) == 0;
+}
+
+bool FilterDocument::hasLine(long n)
+{
+    lock_guard < mutex > hold(lock);
+
+    return n >= 0 && n < (long) starts.size();
+}
+
+const char *FilterDocument::line(long n, size_t & len)
+{
+    len = 0;
+    if (!hasLine(n))
+	return NULL;
+    return source->line(source->lineOf(lineStart(n)), len);
+}
+
+long FilterDocument::lineCount(void)
+{
+    lock_guard < mutex > hold(lock);
+
+    return starts.size();
+}
+
+long FilterDocument::lineOf(off_t at)
+{
+    vector < off_t >::iterator it;
+    lock_guard < mutex > hold(lock);
+
+    it = upper_bound(starts.begin(), starts.end(), at);
+    return it == starts.begin() ? 0 : it - starts.begin() - 1;
+}
+
+off_t FilterDocument::lineStart(long n)
+{
+    lock_guard < mutex > hold(lock);
+
+    return n >= 0 && n < (long) starts.size() ? starts[n] : (off_t) size;
+}
+
+bool FilterDocument::growing(void)
+{
+    return !done;
+}
+
+bool FilterDocument::loaded(void)
+{
+    return true;
+}
+
+string FilterDocument::status(void)
+{
+    char buf[64];
+    long n;
+    int percent;
+
+    {
+	lock_guard < mutex > hold(lock);
+
+	n = starts.size();
+	percent = size > 0 ? (int) (reach * 100.0 / size) : 0;
+    }
+    if (done)
+	snprintf(buf, sizeof(buf), ": %ld line%s", n, n == 1 ? "" : "s");
+    else
+	snprintf(buf, sizeof(buf), ": %ld line%s, %d%%", n,
+		 n == 1 ? "" : "s", percent);
+    return " &" + expr + buf + " ";
+}
+
+const char *FilterDocument::span(off_t at, off_t & from, size_t & len,
+				 size_t & more, string & buf)
+{
+    return source->span(at, from, len, more, buf);
+}
+
+bool FilterDocument::findText(void)
+{
+    return source->findText();
+}
+
+size_t FilterDocument::textFound(void)
+{
+    return source->textFound();
+}
+
+
+Search::Search(Document & doc)
+{
+    source = &doc;
+    origin = 0;
+    size = 0;
+    back = false;
+    quit = false;
+    done = true;
+    sized = false;
+    lo[0] = lo[1] = hi[0] = hi[1] = 0;
+    reach[0] = reach[1] = 0;
+}
+
+Search::~Search()
+{
+    stop();
+}
+
+/***********************************************************************/
+/* Routine: start(pattern,from,backward)                               */
+/* Purpose: To search for a new pattern, dropping any search running.  */
+/*          The length of the text is found by the search thread, as a */
+/*          gzip file has to be inflated through to know it.           */
+/***********************************************************************/
+
+void Search::start(const string & pattern, off_t from, bool backward)
+{
+    stop();
+    origin = from;
+    pat = pattern;
+    back = backward;
+    matches.clear();
+    quit = false;
+    sized = false;
+    done = pat.empty();
+    if (!done)
+	worker = thread(&Search::run, this);
+}
+
+/***********************************************************************/
+/* Routine: parts(from)                                                */
+/* Purpose: To split the text into the two parts searched once its     */
+/*          length is known. Forward it goes from 'from' to the end,   */
+/*          then from the top; backward from 'from' to the top, then   */
+/*          up from the end.                                           */
+/***********************************************************************/
+
+void Search::parts(off_t from)
+{
+    if (from < 0 || (size_t) from > size)
+	from = 0;
+    if (back) {
+	lo[0] = 0;
+	hi[0] = from;
+	lo[1] = from;
+	hi[1] = size;
+	reach[0] = hi[0];
+	reach[1] = hi[1];
+    } else {
+	lo[0] = from;
+	hi[0] = size;
+	lo[1] = 0;
+	hi[1] = from;
+	reach[0] = lo[0];
+	reach[1] = lo[1];
+    }
+}
+
+void Search::stop(void)
+{
+    quit = true;
+    if (worker.joinable())
+	worker.join();
+}
+
+bool Search::running(void) const
+{
+    return !done;
+}
+
+bool Search::backward(void) const
+{
+    return back;
+}
+
+const string & Search::pattern(void) const
+{
+    return pat;
+}
+
+unsigned long Search::found(void)
+{
+    lock_guard < mutex > hold(lock);
+
+    return matches.size();
+}
+
+int Search::progress(void) const
+{
+    size_t part0, part1;
+
+    if (done || size == 0)
+	return 100;
+    if (!sized)
+	return 0;
+    part0 = back ? hi[0] - reach[0] : reach[0] - lo[0];
+    part1 = back ? hi[1] - reach[1] : reach[1] - lo[1];
+    return (int) ((part0 + part1) * 100.0 / size);
+}
+
+/***********************************************************************/
+/* Routine: run()                                                      */
+/* Purpose: The search thread: both parts a chunk at a time, forward   */
+/*          or backward, noting after each chunk how far it has got.   */
+/*          The text comes a piece at a time, with enough of the next  */
+/*          to find a match that runs over into it.                    */
+/***********************************************************************/
+
+void Search::run(void)
+{
+    string buf;
+    const char *text;
+    size_t c, end, len, more, plen = pat.size();
+    off_t from;
+    int part;
+
+    if (!sized) {
+	while (!quit && source->findText());
+	size = source->textFound();
+	parts(origin);
+	sized = true;
+    }
+    for (part = 0; part < 2 && !quit; part++) {
+	if (!back) {
+	    for (c = lo[part]; c < hi[part] && !quit;) {
+		more = plen - 1;
+		text = source->span(c, from, len, more, buf);
+		if (text == NULL)
+		    break;
+		for (; c < hi[part] && c < from + len && !quit; c = end) {
+		    end = hi[part] - c > SEARCHCHUNK ? c + SEARCHCHUNK : hi[part];
+		    if (end > from + len)
+			end = from + len;
+		    scan(text, from, len + more, c, end);
+		    reach[part] = end;
+		}
+	    }
+	} else {
+	    for (c = hi[part]; c > lo[part] && !quit;) {
+		more = plen - 1;
+		text = source->span(c - 1, from, len, more, buf);
+		if (text == NULL)
+		    break;
+		for (; c > lo[part] && c > (size_t) from && !quit; c = end) {
+		    end = c - lo[part] > SEARCHCHUNK ? c - SEARCHCHUNK : lo[part];
+		    if (end < (size_t) from)
+			end = from;
+		    scan(text, from, len + more, end, c);
+		    reach[part] = end;
+		}
+	    }
+	}
+    }
+    done = true;
+}
+
+/***********************************************************************/
+/* Routine: scan(text,at,len,lo,hi)                                    */
+/* Purpose: To find the matches starting in [lo,hi), with memmem (the  */
+/*          two-way algorithm in glibc, vectorized for short patterns) */
+/*          and add them to the set. text holds len bytes of the text  */
+/*          from offset at. Stops the search at MAXMATCHES.            */
+/***********************************************************************/
+
+void Search::scan(const char *text, off_t at, size_t len, size_t from,
+		  size_t to)
+{
+    vector < off_t > hits;
+    const char *p, *end;
+    size_t plen = pat.size();
+
+    p = text + (from - at);
+    end = text + (to + plen - 1 < at + len ? to + plen - 1 - at : len);
+    while (p < end
+	   && (p = (const char *) memmem(p, end - p, pat.data(), plen))
+	   != NULL && p < text + (to - at)) {
+	hits.push_back(p - text + at);
+	p++;
+    }
+    lock_guard < mutex > hold(lock);
+    matches.insert(hits.begin(), hits.end());
+    if (matches.size() >= MAXMATCHES)
+	quit = true;
+}
+
+/***********************************************************************/
+/* Routine: covered(lo,hi)                                             */
+/* Purpose: Whether every match starting in [lo,hi) has been found.    */
+/***********************************************************************/
+
+bool Search::covered(size_t from, size_t to) const
+{
+    size_t a, b;
+    int part;
+
+    if (done || from >= to)
+	return true;
+    if (!sized)
+	return false;
+    for (part = 0; part < 2; part++) {
+	a = back ? reach[part].load() : lo[part];
+	b = back ? hi[part] : reach[part].load();
+	if (from >= a && to <= b)
+	    return true;
+    }
+    return false;
+}
+
+/***********************************************************************/
+/* Routine: next(at,back,match)                                        */
+/* Purpose: The first match at or after 'at', or with back the last    */
+/*          one before it, wrapping around the ends. Returns 1 with    */
+/*          the match, 0 if there is none, -1 if it is not known yet.  */
+/***********************************************************************/
+
+int Search::next(off_t at, bool up, off_t & match)
+{
+    set < off_t >::iterator it;
+    lock_guard < mutex > hold(lock);
+
+    if (!sized && !done)
+	return -1;
+    it = matches.lower_bound(at);
+    if (!up) {
+	if (it != matches.end()) {
+	    match = *it;
+	    return covered(at, match) ? 1 : -1;
+	}
+	if (!covered(at, size))
+	    return -1;
+	if (matches.empty())
+	    return done ? 0 : -1;
+	match = *matches.begin();
+	return covered(0, match) ? 1 : -1;
+    }
+    if (it != matches.begin()) {
+	match = *--it;
+	return covered(match + 1, at) ? 1 : -1;
+    }
+    if (!covered(0, at))
+	return -1;
+    if (matches.empty())
+	return done ? 0 : -1;
+    match = *matches.rbegin();
+    return covered(match + 1, size) ? 1 : -1;
+}
+
+/***********************************************************************/
+/* Routine: reload(doc,appended)                                       */
+/* Purpose: To carry on after the document's text has moved. If text  */
+/*          was only appended to a finished search, the new text is    */
+/*          searched for more matches; otherwise it starts over.       */
+/***********************************************************************/
+
+void Search::reload(Document & doc, bool appended)
+{
+    size_t old = size, plen = pat.size();
+    bool finished = done;
+
+    stop();
+    size = doc.textFound();
+    if (pat.empty())
+	return;
+    if (!appended || !finished || size < old) {
+	start(pat, 0, back);
+	return;
+    }
+    /* matches may start in the last plen-1 bytes of the old text */
+    lo[0] = old >= plen ? old - plen + 1 : 0;
+    hi[0] = size;
+    lo[1] = hi[1] = 0;
+    reach[0] = back ? hi[0] : lo[0];
+    reach[1] = 0;
+    sized = true;
+    quit = false;
+    done = matches.size() >= MAXMATCHES || lo[0] >= size;
+    if (!done)
+	worker = thread(&Search::run, this);
+}
+
+/***********************************************************************/
+/* Routine: marks(start,len,hl)                                        */
+/* Purpose: To flag the bytes of [start,start+len) that are in a match */
+/*          found so far, one flag per byte.                           */
+/***********************************************************************/
+
+void Search::marks(off_t start, size_t len, vector < char >&hl)
+{
+    set < off_t >::iterator it;
+    off_t a, b, plen = pat.size();
+
+    hl.assign(len, 0);
+    lock_guard < mutex > hold(lock);
+    for (it = matches.lower_bound(start - plen + 1);
+	 it != matches.end() && *it < start + (off_t) len; ++it) {
+	a = *it > start ? *it : start;
+	b = *it + plen < start + (off_t) len ? *it + plen : start + len;
+	for (; a < b; a++)
+	    hl[a - start] = 1;
+    }
+}
+
+
+MappedFile::MappedFile()
+{
+    fd = -1;
+    saved = 0;
+    watchFd = fileWatch = dirWatch = -1;
+    tail = 0;
+    oldData = NULL;
+    oldSize = 0;
+    memset(&info, 0, sizeof(info));
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+    if (oldData != NULL)
+	munmap((void *) oldData, oldSize);
+    if (watchFd != -1)
+	::close(watchFd);
+}
+
+/***********************************************************************/
+/* Routine: open(fname)                                                */
+/* Purpose: To map a file for reading. Nothing is read yet: pages come */
+/*          in as lines are asked for.                                 */
+/***********************************************************************/
+
+bool MappedFile::open(const string & fname)
+{
+    void *map;
+
+    close();
+    fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd == -1)
+	return false;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+	close();
+	return false;
+    }
+    if (info.st_size > 0) {
+	map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+	    close();
+	    return false;
+	}
+	setText((const char *) map, info.st_size);
+    }
+    name = fname;
+    return true;
+}
+
+void MappedFile::close(void)
+{
+    stopLoading();
+    if (data != NULL)
+	munmap((void *) data, size);
+    if (fd != -1)
+	::close(fd);
+    fd = -1;
+    name.clear();
+    saved = 0;
+    setText(NULL, 0);
+}
+
+bool MappedFile::isOpen(void) const
+{
+    return fd != -1;
+}
+
+/***********************************************************************/
+/* Routine: sidecar(dir)                                               */
+/* Purpose: Where the line index of this file is kept: next to it as   */
+/*          .name.uidx when dir is empty, else in dir, named after the */
+/*          device and inode so renamed files keep their index.        */
+/***********************************************************************/
+
+string MappedFile::sidecar(const string & dir) const
+{
+    char id[64];
+    string::size_type slash;
+
+    if (!dir.empty()) {
+	snprintf(id, sizeof(id), "/%llx-%llx.uidx",
+		 (unsigned long long) info.st_dev,
+		 (unsigned long long) info.st_ino);
+	return dir + id;
+    }
+    slash = name.rfind('/');
+    if (slash == string::npos)
+	return "." + name + ".uidx";
+    return name.substr(0, slash + 1) + "." + name.substr(slash + 1) +
+	".uidx";
+}
+
+/***********************************************************************/
+/* Routine: tailHash(end)                                              */
+/* Purpose: FNV-1a hash of the block of text ending at end, to tell if */
+/*          an indexed prefix is still the same after the file grew.   */
+/***********************************************************************/
+
+uint64_t MappedFile::tailHash(size_t end) const
+{
+    uint64_t h = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = end > INDEXBLOCK ? end - INDEXBLOCK : 0; i < end; i++) {
+	h ^= (unsigned char) data[i];
+	h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/***********************************************************************/
+/* Routine: loadIndex(path)                                            */
+/* Purpose: To take the line index from a sidecar written for this     */
+/*          file. It is used as is if inode, size and mtime all match; */
+/*          if the file has only grown since and the text the index    */
+/*          ends on is unchanged, it is used as far as it goes and     */
+/*          the rest is indexed as usual. Anything else is ignored,    */
+/*          as is a sidecar whose line starts do not fit the text: not */
+/*          as many as it says, not rising or past where it ends.      */
+/***********************************************************************/
+
+bool MappedFile::loadIndex(const string & path)
+{
+    IndexHeader hdr;
+    struct stat st;
+    FILE *in;
+    bool same, ok;
+    uint64_t i;
+
+    if (fd == -1 || size == 0)
+	return false;
+    in = fopen(path.c_str(), "rb");
+    if (in == NULL)
+	return false;
+    ok = fread(&hdr, sizeof(hdr), 1, in) == 1
+	&& memcmp(hdr.magic, INDEXMAGIC, sizeof(hdr.magic)) == 0
+	&& hdr.dev == (uint64_t) info.st_dev
+	&& hdr.ino == (uint64_t) info.st_ino
+	&& hdr.size <= size && hdr.scanned <= hdr.size
+	&& hdr.scanned > scanned && hdr.lines > 0
+	&& hdr.lines <= hdr.scanned + 1
+	&& fstat(fileno(in), &st) == 0
+	&& (uint64_t) st.st_size == sizeof(hdr) + hdr.lines * sizeof(off_t);
+    if (ok) {
+	same = hdr.size == size && hdr.mtime == info.st_mtim.tv_sec
+	    && hdr.mtimeNsec == info.st_mtim.tv_nsec;
+	ok = same || (hdr.size < size && tailHash(hdr.scanned) == hdr.tail);
+    }
+    if (ok) {
+	starts.resize(hdr.lines);
+	ok = sizeof(off_t) == sizeof(int64_t)
+	    && fread(&starts[0], sizeof(off_t), hdr.lines, in) == hdr.lines
+	    && starts[0] == 0;
+	for (i = 1; ok && i < hdr.lines; i++)
+	    ok = starts[i] > starts[i - 1];
+	ok = ok && (uint64_t) starts[hdr.lines - 1] <= hdr.scanned
+	    && (uint64_t) starts[hdr.lines - 1] < hdr.size;
+    }
+    fclose(in);
+    if (!ok) {
+	setText(data, size);
+	return false;
+    }
+    scanned = hdr.scanned;
+    /* a newline that ended the file then starts a line now */
+    if (scanned == hdr.size && scanned < size && data[scanned - 1] == '\n')
+	starts.push_back(scanned);
+    saved = scanned;
+    return true;
+}
+
+/***********************************************************************/
+/* Routine: saveIndex(path)                                            */
+/* Purpose: To write the line index to a sidecar for the next open,    */
+/*          if it covers more than when it was loaded and the file is  */
+/*          big enough for indexing to take a noticeable time. It is   */
+/*          written to a temporary file renamed into place, so readers */
+/*          never see half of one.                                     */
+/***********************************************************************/
+
+bool MappedFile::saveIndex(const string & path)
+{
+    IndexHeader hdr;
+    string tmp;
+    FILE *out;
+    bool ok;
+
+    stopLoading();
+    if (fd == -1 || size < INDEXCHUNK || scanned <= saved)
+	return false;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEXMAGIC, sizeof(hdr.magic));
+    hdr.dev = info.st_dev;
+    hdr.ino = info.st_ino;
+    hdr.size = size;
+    hdr.mtime = info.st_mtim.tv_sec;
+    hdr.mtimeNsec = info.st_mtim.tv_nsec;
+    hdr.scanned = scanned;
+    hdr.tail = tailHash(scanned);
+    hdr.lines = starts.size();
+
+    tmp = path + ".tmp";
+    out = fopen(tmp.c_str(), "wb");
+    if (out == NULL)
+	return false;
+    ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1
+	&& fwrite(&starts[0], sizeof(off_t), starts.size(), out)
+	== starts.size();
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) == -1) {
+	unlink(tmp.c_str());
+	return false;
+    }
+    saved = scanned;
+    return true;
+}
+
+
+/***********************************************************************/
+/* Routine: watch()                                                    */
+/* Purpose: To follow the file like tail -F: inotify tells of writes   */
+/*          to it, and of files made or moved into its directory, in   */
+/*          case the name is given to a new file when a log rotates.   */
+/***********************************************************************/
+
+bool MappedFile::watch(void)
+{
+    string dir;
+    string::size_type slash;
+
+    if (fd == -1)
+	return false;
+    if (watchFd == -1)
+	watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watchFd == -1)
+	return false;
+    slash = name.rfind('/');
+    dir = slash == string::npos ? "." : name.substr(0, slash + 1);
+    if (dirWatch == -1)
+	dirWatch = inotify_add_watch(watchFd, dir.c_str(),
+				     IN_CREATE | IN_MOVED_TO);
+    watchFile();
+    return fileWatch != -1;
+}
+
+void MappedFile::watchFile(void)
+{
+    if (fileWatch != -1)
+	inotify_rm_watch(watchFd, fileWatch);
+    fileWatch = inotify_add_watch(watchFd, name.c_str(),
+				  IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+				  IN_DELETE_SELF);
+    tail = tailHash(size);
+}
+
+bool MappedFile::growing(void)
+{
+    return watchFd != -1 || Document::growing();
+}
+
+string MappedFile::status(void)
+{
+    return (watchFd != -1 ? " following " : "") + Document::status();
+}
+
+/***********************************************************************/
+/* Routine: remap(len)                                                 */
+/* Purpose: To map the file again at a new length, leaving the index   */
+/*          as it is. The text may move.                               */
+/***********************************************************************/
+
+bool MappedFile::remap(size_t len)
+{
+    void *map = NULL;
+
+    if (len > 0) {
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	    return false;
+    }
+    retire();
+    data = (const char *) map;
+    size = len;
+    return true;
+}
+
+/***********************************************************************/
+/* Routine: retire()                                                   */
+/* Purpose: To put the mapping aside rather than unmap it, as readers  */
+/*          of text() may still be on it; the one put aside before is  */
+/*          unmapped now.                                              */
+/***********************************************************************/
+
+void MappedFile::retire(void)
+{
+    if (oldData != NULL)
+	munmap((void *) oldData, oldSize);
+    oldData = data;
+    oldSize = size;
+    data = NULL;
+    size = 0;
+}
+
+/***********************************************************************/
+/* Routine: update()                                                   */
+/* Purpose: To take in what inotify has seen happen to a followed      */
+/*          file. Appended text is mapped and indexed from where the   */
+/*          index ends, so nothing is read twice; a file truncated,    */
+/*          rewritten, in place or not, or rotated away for a new one  */
+/*          under its name, starts over. Nothing is looked at unless   */
+/*          an event came. The text replaced stays mapped until the    */
+/*          next update, for the caller to move its searches off it    */
+/*          (Search::reload).                                          */
+/***********************************************************************/
+
+int MappedFile::update(void)
+{
+    char buf[4096];
+    struct stat now;
+    string fname;
+    size_t old;
+    bool any = false;
+
+    if (watchFd == -1)
+	return FOLLOWSAME;
+    while (read(watchFd, buf, sizeof(buf)) > 0)
+	any = true;
+    if (!any)
+	return FOLLOWSAME;
+    /* the text is about to move under the indexing thread */
+    stopLoading();
+
+    /* rotated: the name is now another file's */
+    if (stat(name.c_str(), &now) == 0 && S_ISREG(now.st_mode)
+	&& (now.st_ino != info.st_ino || now.st_dev != info.st_dev)) {
+	fname = name;
+	retire();
+	if (!open(fname))
+	    return FOLLOWNEW;
+	watchFile();
+	return FOLLOWNEW;
+    }
+
+    if (fstat(fd, &now) == -1)
+	return FOLLOWSAME;
+    if ((size_t) now.st_size == size) {
+	/* rewritten in place: the mapping shows the new text already, */
+	/* the index and whatever was found in the old one do not      */
+	if (now.st_mtim.tv_sec == info.st_mtim.tv_sec
+	    && now.st_mtim.tv_nsec == info.st_mtim.tv_nsec
+	    && tailHash(size) == tail)
+	    return FOLLOWSAME;
+	info = now;
+	setText(data, size);
+	saved = 0;
+	tail = tailHash(size);
+	return FOLLOWNEW;
+    }
+    old = size;
+    if (!remap(now.st_size))
+	return FOLLOWSAME;
+    info = now;
+    if (size < old || old == 0 || tailHash(old) != tail) {
+	setText(data, size);
+	saved = 0;
+	tail = tailHash(size);
+	return FOLLOWNEW;
+    }
+    /* a newline that ended the file then starts a line now */
+    if (scanned == old && data[old - 1] == '\n')
+	starts.push_back(old);
+    tail = tailHash(size);
+    return FOLLOWGREW;
+}
+
+
+GzipFile::GzipFile()
+{
+    fd = -1;
+    zdata = NULL;
+    zsize = 0;
+    ended = true;
+    last = 0;
+    cacheAt = 0;
+    memset(&zs, 0, sizeof(zs));
+}
+
+GzipFile::~GzipFile()
+{
+    close();
+}
+
+/***********************************************************************/
+/* Routine: isGzip(fname)                                              */
+/* Purpose: Whether a file starts with the gzip magic number.          */
+/***********************************************************************/
+
+bool GzipFile::isGzip(const string & fname)
+{
+    unsigned char magic[2];
+    int in;
+    bool gz;
+
+    in = ::open(fname.c_str(), O_RDONLY);
+    if (in == -1)
+	return false;
+    gz = read(in, magic, 2) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    ::close(in);
+    return gz;
+}
+
+/***********************************************************************/
+/* Routine: open(fname)                                                */
+/* Purpose: To map a gzip file and get ready to inflate it. Nothing is */
+/*          inflated yet.                                              */
+/***********************************************************************/
+
+bool GzipFile::open(const string & fname)
+{
+    struct stat info;
+    void *map;
+    GzipPoint start;
+
+    close();
+    fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd == -1)
+	return false;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)
+	|| info.st_size == 0) {
+	close();
+	return false;
+    }
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+	close();
+	return false;
+    }
+    zdata = (const unsigned char *) map;
+    zsize = info.st_size;
+
+    /* 15 + 32: the largest window, and a gzip or zlib header */
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+	close();
+	return false;
+    }
+    ended = false;
+    zs.next_in = (Bytef *) zdata;
+    zs.avail_in = zsize;
+    window.resize(GZWINDOW);
+    found.resize(GZWINDOW);
+    start.in = start.out = 0;
+    start.bits = -1;
+    points.push_back(start);
+    return true;
+}
+
+void GzipFile::close(void)
+{
+    stopLoading();
+    if (!ended)
+	inflateEnd(&zs);
+    ended = true;
+    if (zdata != NULL)
+	munmap((void *) zdata, zsize);
+    if (fd != -1)
+	::close(fd);
+    fd = -1;
+    zdata = NULL;
+    zsize = 0;
+    last = 0;
+    points.clear();
+    cache.clear();
+    setText(NULL, 0);
+}
+
+bool GzipFile::isOpen(void) const
+{
+    return fd != -1;
+}
+
+/***********************************************************************/
+/* Routine: inflateMore()                                              */
+/* Purpose: To take the indexing pass on until it has inflated some    */
+/*          more text or the file ends. Inflating a deflate block at a */
+/*          time (Z_BLOCK) stops it at each block boundary, where a    */
+/*          checkpoint is left once GZSPAN bytes have gone by since    */
+/*          the last. The text itself only passes through the window.  */
+/***********************************************************************/
+
+void GzipFile::inflateMore(void)
+{
+    unsigned char *from;
+    off_t *end;
+    size_t n;
+    int ret;
+
+    n = 0;
+    while (n == 0 && !ended) {
+	if (zs.avail_out == 0) {
+	    zs.next_out = &window[0];
+	    zs.avail_out = GZWINDOW;
+	}
+	from = zs.next_out;
+	ret = inflate(&zs, Z_BLOCK);
+	n = zs.next_out - from;
+	if (n > 0) {
+	    if (size == 0)
+		starts.push_back(0);
+	    end = findNewlines((const char *) from, n, size, &found[0]);
+	    starts.insert(starts.end(), &found[0], end);
+	    size += n;
+	    scanned = size;
+	    last = from[n - 1];
+	}
+	/* files joined with cat are a gzip member each */
+	if (ret == Z_STREAM_END && zs.avail_in >= 2 && zs.next_in[0] == 0x1f
+	    && zs.next_in[1] == 0x8b)
+	    ret = inflateReset(&zs);
+	if (ret != Z_OK) {
+	    /* the end, or as far as a damaged or unfinished file goes */
+	    inflateEnd(&zs);
+	    ended = true;
+	    if (last == '\n')
+		starts.pop_back();
+	} else if ((zs.data_type & 128) && !(zs.data_type & 64)
+		   && size - points.back().out >= GZSPAN)
+	    addPoint();
+    }
+}
+
+void GzipFile::addPoint(void)
+{
+    GzipPoint p;
+    size_t left = zs.avail_out;
+
+    p.in = zs.next_in - zdata;
+    p.out = size;
+    p.bits = zs.data_type & 7;
+    /* the window runs round: its oldest byte is where output goes next */
+    p.window.assign(window.begin() + (GZWINDOW - left), window.end());
+    p.window.insert(p.window.end(), window.begin(),
+		    window.begin() + (GZWINDOW - left));
+    points.push_back(p);
+}
+
+/***********************************************************************/
+/* Routine: unpack(from,len,out)                                       */
+/* Purpose: To inflate len bytes of text from a checkpoint into out.   */
+/*          Past the start of the file deflate is picked up mid-stream */
+/*          with the bits left over and the window of history.        */
+/***********************************************************************/
+
+void GzipFile::unpack(const GzipPoint & from, size_t len, string & out)
+{
+    z_stream s;
+    int ret;
+    bool raw = from.bits >= 0;
+
+    out.resize(len);
+    memset(&s, 0, sizeof(s));
+    if (inflateInit2(&s, raw ? -15 : 15 + 32) != Z_OK) {
+	out.clear();
+	return;
+    }
+    s.next_in = (Bytef *) zdata + from.in;
+    s.avail_in = zsize - from.in;
+    if (from.bits > 0)
+	inflatePrime(&s, from.bits, zdata[from.in - 1] >> (8 - from.bits));
+    if (raw)
+	inflateSetDictionary(&s, &from.window[0], from.window.size());
+    s.next_out = (Bytef *) & out[0];
+    s.avail_out = len;
+    while (s.avail_out > 0) {
+	ret = inflate(&s, Z_NO_FLUSH);
+	if (ret == Z_STREAM_END && raw && s.avail_in >= 8) {
+	    /* past the trailer of a member, on to the next one's header */
+	    s.next_in += 8;
+	    s.avail_in -= 8;
+	    raw = false;
+	    ret = inflateReset2(&s, 15 + 32);
+	} else if (ret == Z_STREAM_END && !raw && s.avail_in > 0)
+	    ret = inflateReset(&s);
+	if (ret != Z_OK)
+	    break;
+    }
+    out.resize(len - s.avail_out);
+    inflateEnd(&s);
+}
+
+/***********************************************************************/
+/* Routine: block(at,len)                                              */
+/* Purpose: Text already inflated by the indexing pass, read again     */
+/*          from the checkpoint before it. All the text up to the next */
+/*          checkpoint is kept, so the lines around it come without    */
+/*          inflating more.                                            */
+/***********************************************************************/
+
+const char *GzipFile::block(off_t at, size_t len)
+{
+    vector < GzipPoint >::iterator p;
+    size_t want;
+
+    if (at >= cacheAt && at + len <= cacheAt + cache.size())
+	return cache.data() + (at - cacheAt);
+    for (p = points.end() - 1; p != points.begin() && p->out > at; --p);
+    want = at + len - p->out;
+    if (p + 1 != points.end() && want < (size_t) (p[1].out - p->out))
+	want = p[1].out - p->out;
+    else if (p + 1 == points.end() && want < size - p->out)
+	want = size - p->out;
+    unpack(*p, want, cache);
+    cacheAt = p->out;
+    if (at + len > cacheAt + cache.size())
+	return NULL;
+    return cache.data() + (at - cacheAt);
+}
+
+void GzipFile::indexTo(long n)
+{
+    while ((long) starts.size() <= n + 1 && !ended)
+	inflateMore();
+}
+
+const char *GzipFile::line(long n, size_t & len)
+{
+    size_t end;
+    const char *text;
+    lock_guard < mutex > hold(indexLock);
+
+    len = 0;
+    if (n < 0)
+	return NULL;
+    indexTo(n);
+    if (n >= (long) starts.size())
+	return NULL;
+    if (n + 1 < (long) starts.size())
+	end = starts[n + 1] - 1;
+    else if (last == '\n')
+	end = size - 1;
+    else
+	end = size;
+    text = block(starts[n], end - starts[n]);
+    if (text != NULL)
+	len = end - starts[n];
+    return text;
+}
+
+long GzipFile::lineCount(void)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    while (!ended && !loading)
+	inflateMore();
+    return starts.size();
+}
+
+long GzipFile::lineOf(off_t at)
+{
+    vector < off_t >::iterator it;
+    lock_guard < mutex > hold(indexLock);
+
+    while (!ended && (starts.empty() || starts.back() <= at))
+	inflateMore();
+    it = upper_bound(starts.begin(), starts.end(), at);
+    return it == starts.begin() ? 0 : it - starts.begin() - 1;
+}
+
+/***********************************************************************/
+/* Routine: loadMore()                                                 */
+/* Purpose: The indexing pass for load(), GZSPAN bytes of text at a    */
+/*          time. It holds the lock while it inflates, so that is kept */
+/*          short.                                                     */
+/***********************************************************************/
+
+bool GzipFile::loadMore(void)
+{
+    lock_guard < mutex > hold(indexLock);
+    size_t to = size + GZSPAN;
+
+    while (!ended && size < to)
+	inflateMore();
+    return !ended;
+}
+
+bool GzipFile::loaded(void)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    return ended;
+}
+
+string GzipFile::status(void)
+{
+    char buf[32];
+    lock_guard < mutex > hold(indexLock);
+
+    if (!loading || zsize == 0)
+	return "";
+    snprintf(buf, sizeof(buf), " loading %d%% ",
+	     (int) ((zs.next_in - zdata) * 100.0 / zsize));
+    return buf;
+}
+
+size_t GzipFile::memory(void)
+{
+    size_t bytes;
+
+    bytes = Document::memory();
+    lock_guard < mutex > hold(indexLock);
+    bytes += found.capacity() * sizeof(off_t) + window.capacity();
+    bytes += points.capacity() * (sizeof(GzipPoint) + GZWINDOW);
+    return bytes + cache.capacity();
+}
+
+/***********************************************************************/
+/* Routine: span(at,from,len,more,buf)                                 */
+/* Purpose: The text from the checkpoint before at to the next one,    */
+/*          and more bytes past it, inflated into buf. The file is     */
+/*          indexed as far as that checkpoint under the lock; the text */
+/*          is inflated outside it, so viewers are not kept waiting.   */
+/***********************************************************************/
+
+const char *GzipFile::span(off_t at, off_t & from, size_t & len,
+			   size_t & more, string & buf)
+{
+    GzipPoint p;
+    size_t end, i;
+
+    {
+	lock_guard < mutex > hold(indexLock);
+
+	if (points.empty())
+	    return NULL;
+	while (!ended && points.back().out <= at)
+	    inflateMore();
+	if (at < 0 || (size_t) at >= size)
+	    return NULL;
+	for (i = points.size() - 1; i > 0 && points[i].out > at; i--);
+	p = points[i];
+	end = i + 1 < points.size()? (size_t) points[i + 1].out : size;
+    }
+    unpack(p, end - p.out + more, buf);
+    if (buf.size() <= (size_t) (at - p.out))
+	return NULL;
+    from = p.out;
+    len = buf.size() < end - p.out ? buf.size() : end - p.out;
+    more = buf.size() - len;
+    return buf.data();
+}
+
+/***********************************************************************/
+/* Routine: findText() / textFound()                                   */
+/* Purpose: The indexing pass a GZSPAN further, for threads that must  */
+/*          know the length of the text; and that length so far.      */
+/***********************************************************************/
+
+bool GzipFile::findText(void)
+{
+    return loadMore();
+}
+
+size_t GzipFile::textFound(void)
+{
+    lock_guard < mutex > hold(indexLock);
+
+    return size;
+}
+
+
+HexDocument::HexDocument(Document & src, int bytes)
+{
+    size_t len;
+
+    source = &src;
+    len = src.textFound();
+    this->bytes = bytes > 0 ? bytes : 1;
+    for (digits = 8; digits < 16 && (len >> (4 * digits)) > 0; digits++);
+    piece = NULL;
+    pieceAt = 0;
+    pieceLen = 0;
+    found = false;
+}
+
+HexDocument::~HexDocument()
+{
+    stopLoading();
+}
+
+/***********************************************************************/
+/* Routine: rowBytes(width)                                            */
+/* Purpose: The bytes in a row of a hex dump width columns wide: a     */
+/*          multiple of 4, from 4 to 32, with 11 columns for offset    */
+/*          and gaps and 4 for each byte, in hex and as text.          */
+/***********************************************************************/
+
+int HexDocument::rowBytes(int width)
+{
+    int n = (width - 11) / 4 / 4 * 4;
+
+    return n < 4 ? 4 : n > 32 ? 32 : n;
+}
+
+bool HexDocument::hasLine(long n)
+{
+    return n >= 0 && n < lineCount();
+}
+
+/***********************************************************************/
+/* Routine: line(n,len)                                                */
+/* Purpose: Row n of the dump, formatted now. It stays good until the  */
+/*          next row is asked for. Its bytes come from the piece of    */
+/*          the source's text kept from the row before, if they are in */
+/*          it.                                                        */
+/***********************************************************************/
+
+const char *HexDocument::line(long n, size_t & len)
+{
+    char hex[64], *p;
+    const unsigned char *b;
+    off_t at, from;
+    size_t total, got, more;
+    int i, count;
+
+    len = 0;
+    total = source->textFound();
+    at = (off_t) n * bytes;
+    if (n < 0 || (size_t) at >= total)
+	return NULL;
+    count = total - at < (size_t) bytes ? total - at : bytes;
+    if (piece == NULL || at < pieceAt
+	|| (size_t) (at - pieceAt) + count > pieceLen) {
+	more = bytes;
+	piece = source->span(at, from, got, more, pieceBuf);
+	if (piece == NULL)
+	    return NULL;
+	pieceAt = from;
+	pieceLen = got + more;
+    }
+    b = (const unsigned char *) piece + (at - pieceAt);
+    hexBytes(b, count, hex);
+
+    row.assign(digits + 2 + 4 * bytes + 1, ' ');
+    p = &row[0];
+    snprintf(p, digits + 1, "%0*llx", digits,
+	     (unsigned long long) n * bytes);
+    p[digits] = ' ';
+    p += digits + 2;
+    for (i = 0; i < count; i++, p += 3) {
+	p[0] = hex[2 * i];
+	p[1] = hex[2 * i + 1];
+    }
+    p = &row[digits + 2 + 3 * bytes + 1];
+    for (i = 0; i < count; i++)
+	p[i] = b[i] >= ' ' && b[i] < 127 ? b[i] : '.';
+    row.resize(digits + 2 + 3 * bytes + 1 + count);
+    len = row.size();
+    return row.data();
+}
+
+long HexDocument::lineCount(void)
+{
+    return (source->textFound() + bytes - 1) / bytes;
+}
+
+/***********************************************************************/
+/* Routine: loadMore() / loaded() / growing() / status()               */
+/* Purpose: Loading a dump is finding the source's text, for a gzip    */
+/*          file inflating it through; the rows grow as it goes.       */
+/***********************************************************************/
+
+bool HexDocument::loadMore(void)
+{
+    found = !source->findText();
+    return !found;
+}
+
+bool HexDocument::loaded(void)
+{
+    return found;
+}
+
+bool HexDocument::growing(void)
+{
+    return Document::growing() || source->growing();
+}
+
+string HexDocument::status(void)
+{
+    return Document::growing() ? source->status() : "";
+}
+
+const char *HexDocument::span(off_t at, off_t & from, size_t & len,
+			      size_t & more, string & buf)
+{
+    return source->span(at, from, len, more, buf);
+}
+
+bool HexDocument::findText(void)
+{
+    return source->findText();
+}
+
+size_t HexDocument::textFound(void)
+{
+    return source->textFound();
+}
+
+long HexDocument::lineOf(off_t at)
+{
+    return at / bytes;
+}
+
+off_t HexDocument::lineStart(long n)
+{
+    off_t total = source->textFound();
+
+    return n * bytes < total ? n * bytes : total;
+}
+
+/***********************************************************************/
+/* Routine: highlight(n,len,s,hl)                                      */
+/* Purpose: To flag a row's bytes in a match, in hex and as text.      */
+/***********************************************************************/
+
+void HexDocument::highlight(long n, size_t len, Search & s,
+			    vector < char >&hl)
+{
+    vector < char >marked;
+    size_t i, count, total;
+
+    total = source->textFound();
+    count = total - n * bytes < (size_t) bytes ? total - n * bytes : bytes;
+    s.marks(n * bytes, count, marked);
+    hl.assign(len, 0);
+    for (i = 0; i < count; i++)
+	if (marked[i]) {
+	    hl[digits + 2 + 3 * i] = hl[digits + 2 + 3 * i + 1] = 1;
+	    hl[digits + 2 + 3 * bytes + 1 + i] = 1;
+	}
+}
+
+
+TextDocument::TextDocument(const string & text)
+{
+    setText(text.data(), text.size());
+}
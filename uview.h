@@ -0,0 +1,372 @@
+#ifndef U_VIEW_H
+#define U_VIEW_H
+
+// Curses GUI utilities: documents shown by the file viewers
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <regex.h>
+#include <zlib.h>
+
+#define INDEXCHUNK (8 << 20)	/* least bytes worth a thread of their own */
+#define INDEXBLOCK 4096		/* bytes indexed at a time on demand */
+#define INDEXMAGIC "UIDX0001"	/* sidecar line index, format 1 */
+
+// Newline kernels: the widest the CPU has (AVX2, SSE2 or plain C) is
+// picked on first use. findNewlines stores base + i + 1, the start of
+// the next line, for each newline at text[i] and returns the end.
+long countNewlines(const char *text, size_t len);
+off_t *findNewlines(const char *text, size_t len, off_t base, off_t * out);
+const char *newlineKernel(void);
+
+// Text kernels, picked the same way. plainBytes is the length of the
+// run of bytes at text that show as they are, up to the first control
+// character, C0 or C1, or DEL; hexBytes writes two hex digits for each
+// byte.
+size_t plainBytes(const char *text, size_t len);
+void hexBytes(const unsigned char *in, size_t len, char *out);
+
+#define TIMEPROBE 64		/* lines searched for a timestamp at a probe */
+#define SEARCHCHUNK (1 << 20)	/* bytes searched between progress updates */
+#define MAXMATCHES 1000000	/* a search stops after this many matches */
+#define FILTERCHUNK (256 << 10)	/* bytes filtered between updates */
+#define GZSPAN (1 << 20)	/* least text between gzip checkpoints */
+#define GZWINDOW 32768		/* deflate history kept at a checkpoint */
+
+/* what Document::update() found: a followed file is the same, has had */
+/* text appended, or was truncated or rotated and is shown anew        */
+#define FOLLOWSAME 0
+#define FOLLOWGREW 1
+#define FOLLOWNEW 2
+
+// A timestamp found near the start of a line. day is yyyymmdd, or mmdd
+// for syslog dates without a year, or -1 when only a time was found.
+struct LineTime {
+    long day;
+    long secs;			// since midnight
+};
+
+bool parseTime(const char *text, size_t len, LineTime & t);
+bool timeBefore(const LineTime & a, const LineTime & b);
+
+class Search;
+
+// Text the viewers show, one line at a time. Line offsets are found on
+// demand, only as far as a caller has asked, so nothing is formatted or
+// indexed beyond what has been on the screen. load() indexes the rest
+// on a thread of its own, which splits each batch across the cores;
+// until it is done lineCount() is the lines found so far.
+//
+// span() gives threads that scan the whole text, such as a search, the
+// piece of it holding a byte, starting at from and len long, with up
+// to more bytes of what follows (more is set to those there are): text
+// in memory is all one piece, a gzip file's is inflated into buf from
+// one checkpoint to the next. NULL past the end.
+class Document {
+  public:
+    virtual bool hasLine(long n);	// indexes up to line n if needed
+    virtual const char *line(long n, size_t & len);	// without the newline
+    virtual long lineCount(void);	// all lines, or those found by load()
+    long findTime(const LineTime & t);	// first line stamped t or later
+    virtual long lineOf(off_t at);	// line holding a byte, indexing to it
+    virtual off_t lineStart(long n);
+    virtual const char *text(size_t & len);	// all of it, if in memory
+    virtual const char *span(off_t at, off_t & from, size_t & len,
+			     size_t & more, std::string & buf);
+    virtual bool findText(void);	// more of it, false once all found
+    virtual size_t textFound(void);	// the length found so far
+    virtual bool growing(void);	// lines still being added
+    virtual std::string status(void);	// for the viewer's border
+    virtual int update(void);	// takes in changes: FOLLOWSAME etc.
+    virtual void highlight(long n, size_t len, Search & s,
+			   std::vector < char >&hl);
+    void load(void);
+    void waitLoaded(void);	// until load() is done
+    virtual bool loaded(void);	// all of it indexed
+    virtual size_t memory(void);	// bytes held for the index and such
+
+     Document();
+     virtual ~Document();
+
+  protected:
+    void setText(const char *text, size_t len);
+    virtual void indexTo(long n);
+    void indexAll(void);	// the rest, on all cores
+    virtual bool loadMore(void);	// false once all is indexed
+    void loadRun(void);
+    void stopLoading(void);
+    long stampedLine(long from, long to, LineTime & t);
+    static unsigned int cores(void);
+    static void startsIn(const char *text, size_t from, size_t to,
+			 size_t size, std::vector < off_t > &out);
+    static long countStarts(const char *text, size_t from, size_t to,
+			    size_t size);
+    static void findStarts(const char *text, size_t from, size_t to,
+			   size_t size, off_t * out);
+
+    const char *data;
+    size_t size;
+    size_t scanned;		// bytes indexed so far
+    std::vector < off_t > starts;	// offset of each line indexed
+    std::mutex indexLock;	// over the index while load() runs
+    std::thread loader;
+    std::atomic < bool > loading;
+    std::atomic < bool > stopLoad;
+
+  private:
+    // not copyable: the index points into text owned elsewhere
+    Document(const Document &);
+    Document & operator=(const Document &);
+};
+
+// A file mapped read-only; pages come in as lines are asked for. Its
+// line index can be kept in a sidecar file for the next open. text()
+// from before an update() stays good until the update after it, so a
+// search still running on it can be moved to the new text in between.
+class MappedFile:public Document {
+  public:
+    bool open(const std::string & fname);
+    void close(void);
+    bool isOpen(void) const;
+
+    std::string sidecar(const std::string & dir) const;
+    bool loadIndex(const std::string & path);
+    bool saveIndex(const std::string & path);
+
+    bool watch(void);		// follow appends, truncation and rotation
+    bool growing(void);
+    std::string status(void);
+    int update(void);
+
+     MappedFile();
+    ~MappedFile();
+
+  private:
+    uint64_t tailHash(size_t end) const;
+    bool remap(size_t len);
+    void retire(void);
+    void watchFile(void);
+
+    int fd;
+    std::string name;
+    struct stat info;		// identity of the file mapped
+    size_t saved;		// bytes indexed when loaded or saved
+    int watchFd;		// inotify instance, -1 when not following
+    int fileWatch, dirWatch;
+    uint64_t tail;		// tailHash(size) when last updated
+    const char *oldData;	// mapping the last update() replaced,
+    size_t oldSize;		// unmapped at the next one
+};
+
+// Header of a sidecar index; the line starts follow as int64_t
+struct IndexHeader {
+    char magic[8];
+    uint64_t dev, ino, size;
+    int64_t mtime, mtimeNsec;
+    uint64_t scanned;		// bytes the index covers
+    uint64_t tail;		// hash of the bytes just before scanned
+    uint64_t lines;
+};
+
+// A search for a fixed string run by a thread of its own over the whole
+// text of a document, a chunk at a time, starting at a given offset and
+// wrapping around. Matches can be asked for while it runs; an answer is
+// only given once the text it depends on has been searched.
+class Search {
+  public:
+    void start(const std::string & pattern, off_t from, bool backward);
+    void stop(void);
+    bool running(void) const;
+    bool backward(void) const;
+    const std::string & pattern(void) const;
+    unsigned long found(void);	// matches so far
+    int progress(void) const;	// percent of the text searched
+    int next(off_t at, bool up, off_t & match);
+    void marks(off_t start, size_t len, std::vector < char >&hl);
+    void reload(Document & doc, bool appended);
+
+     Search(Document & doc);
+    ~Search();
+
+  private:
+    void run(void);
+    void parts(off_t from);
+    void scan(const char *text, off_t at, size_t len, size_t lo,
+	      size_t hi);
+    bool covered(size_t lo, size_t hi) const;
+
+    Document *source;
+    off_t origin;		// where it started
+    size_t size;
+    std::string pat;
+    bool back;
+    std::thread worker;
+    std::atomic < bool > quit;
+    std::atomic < bool > done;
+    std::atomic < bool > sized;	// size and the parts are known
+    size_t lo[2], hi[2];	// the two parts searched, in order
+    std::atomic < size_t > reach[2];	// how far each part has got
+    std::mutex lock;
+    std::set < off_t > matches;
+};
+
+// The lines of another document that match an extended regular
+// expression, found by a thread of its own a chunk at a time. Lines can
+// be read while it runs: the line count is what has been found so far.
+// Line offsets are those of the document filtered, and its lines and
+// text are read from there.
+class FilterDocument:public Document {
+  public:
+    bool start(const std::string & regex);	// false if it does not compile
+    bool hasLine(long n);
+    const char *line(long n, size_t & len);
+    long lineCount(void);
+    long lineOf(off_t at);
+    off_t lineStart(long n);
+    bool growing(void);
+    std::string status(void);
+    bool loaded(void);
+    const char *span(off_t at, off_t & from, size_t & len, size_t & more,
+		     std::string & buf);
+    bool findText(void);
+    size_t textFound(void);
+
+     FilterDocument(Document & src);
+    ~FilterDocument();
+
+  private:
+    void run(void);
+    void stop(void);
+    bool matches(const char *text, size_t len);
+
+    Document *source;
+    std::string expr;
+    regex_t re;
+    bool compiled;
+    std::thread worker;
+    std::atomic < bool > quit;
+    std::atomic < bool > done;
+    std::atomic < size_t > reach;	// bytes filtered so far
+    std::mutex lock;		// over starts
+};
+
+// Where inflating a gzip file can start again without what came before:
+// the compressed offset, the bits of the byte before it still to use
+// (-1 for the start of the file) and the history deflate may refer to.
+struct GzipPoint {
+    off_t in, out;
+    int bits;
+    std::vector < unsigned char >window;
+};
+
+// A gzip file, mapped and inflated as lines are asked for. Inflating it
+// through once indexes its lines and leaves a checkpoint about every
+// GZSPAN bytes of text, so a line anywhere is then read by inflating
+// from the checkpoint before it only. Nothing but the window on screen
+// is kept inflated; searches and filters inflate the text a piece at a
+// time, each into a buffer of its own.
+class GzipFile:public Document {
+  public:
+    bool open(const std::string & fname);
+    void close(void);
+    bool isOpen(void) const;
+    static bool isGzip(const std::string & fname);
+
+    const char *line(long n, size_t & len);
+    long lineCount(void);
+    long lineOf(off_t at);
+    const char *span(off_t at, off_t & from, size_t & len, size_t & more,
+		     std::string & buf);
+    bool findText(void);
+    size_t textFound(void);
+    std::string status(void);
+    bool loaded(void);
+    size_t memory(void);
+
+     GzipFile();
+    ~GzipFile();
+
+  protected:
+    void indexTo(long n);
+    bool loadMore(void);
+
+  private:
+    void inflateMore(void);
+    void addPoint(void);
+    void unpack(const GzipPoint & from, size_t len, std::string & out);
+    const char *block(off_t at, size_t len);
+
+    int fd;
+    const unsigned char *zdata;
+    size_t zsize;
+    z_stream zs;		// the pass that indexes, where it has got to
+    bool ended;
+    char last;			// the last byte inflated
+    std::vector < unsigned char >window;	// its output, round robin
+    std::vector < off_t > found;
+    std::vector < GzipPoint > points;
+    std::string cache;		// text inflated from a checkpoint
+    off_t cacheAt;
+};
+
+// Another document's bytes as a hex dump, a line for each row of bytes:
+// the offset, the bytes in hex, and the bytes again with anything not
+// printable as a dot. Rows are only formatted as they are asked for,
+// from the piece of the text around them; while the source is still
+// being indexed the dump goes as far as it has got.
+class HexDocument:public Document {
+  public:
+    bool hasLine(long n);
+    const char *line(long n, size_t & len);
+    long lineCount(void);
+    long lineOf(off_t at);
+    off_t lineStart(long n);
+    void highlight(long n, size_t len, Search & s,
+		   std::vector < char >&hl);
+    bool growing(void);
+    std::string status(void);
+    bool loaded(void);
+    const char *span(off_t at, off_t & from, size_t & len, size_t & more,
+		     std::string & buf);
+    bool findText(void);
+    size_t textFound(void);
+    static int rowBytes(int width);	// the most that fit in width
+
+     HexDocument(Document & src, int bytes);
+    ~HexDocument();
+
+  protected:
+    bool loadMore(void);
+
+  private:
+    Document *source;
+    int bytes;			// in a row
+    int digits;			// of the offsets
+    std::string row;		// the line asked for last
+    const char *piece;		// the source's text around it
+    off_t pieceAt;
+    size_t pieceLen;
+    std::string pieceBuf;
+    std::atomic < bool > found;	// all of the source's text
+};
+
+// A string in memory, which must outlive the document
+class TextDocument:public Document {
+  public:
+    TextDocument(const std::string & text);
+};
+
+#endif